@@ -17,6 +17,10 @@
 #include "Image.h"
 #include "Error.h"
 #include "Convert.h"
+#include <limits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 //
 // Type conversion utilities
@@ -53,6 +57,117 @@ extern void ScaleAndOffsetLine(T1* src, T2* dst, int n,
         }
 }*/
 
+//  SIMD specializations of ScaleAndOffsetLine.  They match the scalar
+//  code exactly: the clip is max(val, minVal) followed by min(., maxVal)
+//  with the same operand order (so a NaN becomes minVal, as with __max),
+//  and float -> uchar truncates (cvtt) before saturating packs, which
+//  cannot change an already clipped value.
+
+template <>
+void ScaleAndOffsetLine(uchar* src, float* dst, int n,
+                        float scale, float offset,
+                        float minVal, float maxVal)
+{
+    const bool scaleOffset = (scale != 1.0f) || (offset != 0.0f);
+    const bool clip = (minVal < maxVal);
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 s  = _mm_set1_ps(scale);
+    const __m128 o  = _mm_set1_ps(offset);
+    const __m128 lo = _mm_set1_ps(minVal);
+    const __m128 hi = _mm_set1_ps(maxVal);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i b  = _mm_loadu_si128((const __m128i *) &src[i]);
+        __m128i w0 = _mm_unpacklo_epi8(b, zero);
+        __m128i w1 = _mm_unpackhi_epi8(b, zero);
+        __m128 v[4];
+        v[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w0, zero));
+        v[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(w0, zero));
+        v[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w1, zero));
+        v[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(w1, zero));
+        for (int k = 0; k < 4; k++)
+        {
+            if (scaleOffset)
+                v[k] = _mm_add_ps(_mm_mul_ps(v[k], s), o);
+            if (clip)
+                v[k] = _mm_min_ps(_mm_max_ps(v[k], lo), hi);
+            _mm_storeu_ps(&dst[i + 4*k], v[k]);
+        }
+    }
+#endif
+    ScaleAndOffsetLineScalar(&src[i], &dst[i], n - i, scale, offset, minVal, maxVal);
+}
+
+template <>
+void ScaleAndOffsetLine(float* src, uchar* dst, int n,
+                        float scale, float offset,
+                        uchar minVal, uchar maxVal)
+{
+    const bool scaleOffset = (scale != 1.0f) || (offset != 0.0f);
+    const bool clip = (minVal < maxVal);
+    int i = 0;
+#ifdef __SSE2__
+    // (without clipping an out of range value is undefined in the scalar
+    //  code too, so only the clipped case is worth vectorizing)
+    const __m128 s  = _mm_set1_ps(scale);
+    const __m128 o  = _mm_set1_ps(offset);
+    const __m128 lo = _mm_set1_ps(minVal);
+    const __m128 hi = _mm_set1_ps(maxVal);
+    for (; clip && i + 16 <= n; i += 16)
+    {
+        __m128i q[4];
+        for (int k = 0; k < 4; k++)
+        {
+            __m128 v = _mm_loadu_ps(&src[i + 4*k]);
+            if (scaleOffset)
+                v = _mm_add_ps(_mm_mul_ps(v, s), o);
+            v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+            q[k] = _mm_cvttps_epi32(v);
+        }
+        __m128i w0 = _mm_packs_epi32(q[0], q[1]);
+        __m128i w1 = _mm_packs_epi32(q[2], q[3]);
+        _mm_storeu_si128((__m128i *) &dst[i], _mm_packus_epi16(w0, w1));
+    }
+#endif
+    ScaleAndOffsetLineScalar(&src[i], &dst[i], n - i, scale, offset, minVal, maxVal);
+}
+
+template <>
+void ScaleAndOffsetLine(float* src, float* dst, int n,
+                        float scale, float offset,
+                        float minVal, float maxVal)
+{
+    const bool scaleOffset = (scale != 1.0f) || (offset != 0.0f);
+    const bool clip = (minVal < maxVal);
+    if (! scaleOffset && ! clip)
+    {
+        memcpy(dst, src, n*sizeof(float));
+        return;
+    }
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 s  = _mm_set1_ps(scale);
+    const __m128 o  = _mm_set1_ps(offset);
+    const __m128 lo = _mm_set1_ps(minVal);
+    const __m128 hi = _mm_set1_ps(maxVal);
+    for (; i + 8 <= n; i += 8)
+    {
+        for (int k = 0; k < 8; k += 4)
+        {
+            __m128 v = _mm_loadu_ps(&src[i + k]);
+            if (scaleOffset)
+                v = _mm_add_ps(_mm_mul_ps(v, s), o);
+            if (clip)
+                v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+            _mm_storeu_ps(&dst[i + k], v);
+        }
+    }
+#endif
+    ScaleAndOffsetLineScalar(&src[i], &dst[i], n - i, scale, offset, minVal, maxVal);
+}
+
 template <class T1, class T2>
 extern void ScaleAndOffset(CImageOf<T1>& src, CImageOf<T2>& dst, float scale, float offset)
 {
@@ -76,12 +191,21 @@ extern void ScaleAndOffset(CImageOf<T1>& src, CImageOf<T2>& dst, float scale, fl
     //    src.MaxVal() * scale + offset <= maxVal)
     //    minVal = maxVal = 0;
 
+    // A plain copy between integer types whose range fits can't clip,
+    //  which turns same-type copies into memcpy.  (Not for floats: the
+    //  clip maps inf/NaN to +/-FLT_MAX, and callers may rely on that.)
+    if (scale == 1.0f && offset == 0.0f &&
+        std::numeric_limits<T1>::is_integer &&
+        std::numeric_limits<T1>::min() >= std::numeric_limits<T2>::lowest() &&
+        std::numeric_limits<T1>::max() <= std::numeric_limits<T2>::max())
+        minVal = maxVal = 0;
+
     // Process each row
     for (int y = 0; y < sShape.height; y++)
     {
-        int n = sShape.width * sShape.nBands;
-        ScaleAndOffsetLine(&src.Pixel(0, y, 0), &dst.Pixel(0, y, 0),
-                           n, scale, offset, minVal, maxVal);
+        CRowSpan<T1> srcR = src.Row(y);
+        ScaleAndOffsetLine(srcR.Data(), dst.Row(y).Data(),
+                           srcR.Size(), scale, offset, minVal, maxVal);
     }
 }
 
@@ -105,11 +229,14 @@ extern CImageOf<T> ConvertToRGBA(CImageOf<T> src)
     int aC = dst.alphaChannel;
     for (int y = 0; y < sShape.height; y++)
     {
-        T* srcP = &src.Pixel(0, y, 0);
-        T* dstP = &dst.Pixel(0, y, 0);
-        for (int x = 0; x < sShape.width; x++, srcP++)
-            for (int b = 0; b < dShape.nBands; b++, dstP++)
-                *dstP = (b == aC) ? 255 : *srcP;
+        T* srcP = src.Row(y).Data();
+        CRowSpan<T> dstR = dst.Row(y);
+        for (int b = 0; b < dShape.nBands; b++)
+        {
+            CStridedSpan<T> dstB = dstR.Band(b);
+            for (int x = 0; x < sShape.width; x++)
+                dstB[x] = (b == aC) ? 255 : srcP[x];
+        }
     }
     return dst;
 }
@@ -141,41 +268,29 @@ extern void BandSelect(CImageOf<T>& src, CImageOf<T>& dst, int sBand, int dBand)
     // Process each row
     for (int y = 0; y < sShape.height; y++)
     {
-        T* srcP = &src.Pixel(0, y, 0);
-        T* dstP = &dst.Pixel(0, y, 0);
-        for (int x = 0; x < sShape.width; x++, srcP += sB, dstP += dB)
-            dstP[dBand] = srcP[sBand];
+        CStridedSpan<T> srcB = src.Band(y, sBand);
+        CStridedSpan<T> dstB = dst.Band(y, dBand);
+        for (int x = 0; x < sShape.width; x++)
+            dstB[x] = srcB[x];
     }
 }
 
 //
 // Force instantiation for the types we care about (uchar, int, float)
+//  (explicitly: an implicit instantiation may be inlined away entirely)
 //
 
-template <class T1>
-void CopyPixelsInstantiate(CImageOf<T1> s1)
-{
-    CByteImage  b2;
-    CIntImage   i2;
-    CFloatImage f2;
-    CopyPixels(s1, b2);
-    CopyPixels(s1, i2);
-    CopyPixels(s1, f2);
-}
+#define INSTANTIATE_SCALE_AND_OFFSET(T1, T2)                            \
+template void ScaleAndOffset(CImageOf<T1>& src, CImageOf<T2>& dst,      \
+                             float scale, float offset);
 
-template <class T>
-int InstantiateConvert(CImageOf<T> src)
-{
-    CopyPixelsInstantiate(src);
-    CImageOf<T> r1 = ConvertToRGBA(src);
-    CImageOf<T> r2 = ConvertToGray(src);
-    BandSelect(r1, r2, 0, 0);
-    return (int)r1.Pixel(0, 0, 0);
-}
+#define INSTANTIATE_CONVERT(T)                                          \
+INSTANTIATE_SCALE_AND_OFFSET(T, uchar)                                  \
+INSTANTIATE_SCALE_AND_OFFSET(T, int)                                    \
+INSTANTIATE_SCALE_AND_OFFSET(T, float)                                  \
+template CImageOf<T> ConvertToRGBA(CImageOf<T> src);                    \
+template void BandSelect(CImageOf<T>& src, CImageOf<T>& dst, int sBand, int dBand);
 
-void InstantiateAllConverts(void)
-{
-    InstantiateConvert(CByteImage());
-    InstantiateConvert(CIntImage());
-    InstantiateConvert(CFloatImage());
-}
+INSTANTIATE_CONVERT(uchar)
+INSTANTIATE_CONVERT(int)
+INSTANTIATE_CONVERT(float)
@@ -45,10 +45,13 @@
 //
 ///////////////////////////////////////////////////////////////////////////
 
+#include <string.h>
+#include <type_traits>
+
 template <class T1, class T2>
-void ScaleAndOffsetLine(T1* src, T2* dst, int n,
-                        float scale, float offset,
-                        T2 minVal, T2 maxVal)
+inline void ScaleAndOffsetLineScalar(T1* src, T2* dst, int n,
+                                     float scale, float offset,
+                                     T2 minVal, T2 maxVal)
 {
     // This routine does NOT round values when converting from float to int
     const bool scaleOffset = (scale != 1.0f) || (offset != 0.0f);
@@ -67,7 +70,7 @@ void ScaleAndOffsetLine(T1* src, T2* dst, int n,
         {
             dst[i] = (T2) __min(__max(src[i], minVal), maxVal);
         }
-    else if (typeid(T1) == typeid(T2))
+    else if (std::is_same<T1, T2>::value)
         memcpy(dst, src, n*sizeof(T2));
     else
         for (int i = 0; i < n; i++)
@@ -76,6 +79,33 @@ void ScaleAndOffsetLine(T1* src, T2* dst, int n,
         }
 }
 
+template <class T1, class T2>
+void ScaleAndOffsetLine(T1* src, T2* dst, int n,
+                        float scale, float offset,
+                        T2 minVal, T2 maxVal)
+{
+    ScaleAndOffsetLineScalar(src, dst, n, scale, offset, minVal, maxVal);
+}
+
+// The common conversions are specialized (with SIMD bodies) in Convert.cpp,
+//  so the choice is made at compile time; they compute the same values
+//  as the scalar version above (the left-over pixels of a row use it)
+
+template <>
+void ScaleAndOffsetLine(uchar* src, float* dst, int n,
+                        float scale, float offset,
+                        float minVal, float maxVal);
+
+template <>
+void ScaleAndOffsetLine(float* src, uchar* dst, int n,
+                        float scale, float offset,
+                        uchar minVal, uchar maxVal);
+
+template <>
+void ScaleAndOffsetLine(float* src, float* dst, int n,
+                        float scale, float offset,
+                        float minVal, float maxVal);
+
 template <class T1, class T2>
 void ScaleAndOffset(CImageOf<T1>& src, CImageOf<T2>& dst,
                     float scale, float offset);
@@ -110,8 +140,8 @@ static CImageOf<T> ConvertToGray(CImageOf<T> src)
     T maxVal = dst.MaxVal();
     for (int y = 0; y < sShape.height; y++)
     {
-        T* srcP = &src.Pixel(0, y, 0);
-        T* dstP = &dst.Pixel(0, y, 0);
+        T* srcP = src.Row(y).Data();
+        T* dstP = dst.Row(y).Data();
         for (int x = 0; x < sShape.width; x++, srcP += 4, dstP++)
         {
             RGBA<T>& p = *(RGBA<T> *) srcP;
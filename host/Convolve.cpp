@@ -10,13 +10,24 @@
 //  with minimal loss in precision.  This also avoids excessive type
 //  conversion during convolution, since the kernels are floats anyway.
 //
+//  The row buffer is indexed as a ring (source row y lives in buffer
+//  line y % kY), so advancing one output row fills one new line rather
+//  than shifting the whole buffer up.  The inner loops run over whole
+//  rows (all bands at once), with the kernel width fixed at compile time
+//  for the common 1/3/5/7-tap kernels and AVX2/AVX-512 FMA bodies when
+//  the compiler targets them.
+//
+//  The separable code does not build intermediate images: each band of
+//  output rows keeps a ring of horizontally filtered (and decimated)
+//  rows, and the vertical pass is only evaluated for the output rows,
+//  so decimation does not pay for the rows it throws away.
+//
+//  Large images are split into horizontal bands processed by separate
+//  threads (see SetConvolveThreads()).  Each band has its own buffers.
+//
 //  If fixpoint variants are desired for efficiency (e.g., using
 //  multimedia extensions), then this would have to be modified.
 //
-//  TODO:  this current version is not very efficient.  For example,
-//  the separable code uses an intermediate image, instead of just a
-//  row buffer.  Also, downsampling convolution could be more efficient.
-//
 // SEE ALSO
 //  Convolve.h          longer description of these routines
 //
@@ -29,6 +40,39 @@
 #include "Error.h"
 #include "Convert.h"
 #include "Convolve.h"
+#include <string.h>
+#include <limits.h>
+#include <vector>
+#include <thread>
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define CONV_LANES          16
+#define CONV_VEC            __m512
+#define CONV_ZERO()         _mm512_setzero_ps()
+#define CONV_SET1(x)        _mm512_set1_ps(x)
+#define CONV_LOAD(p)        _mm512_loadu_ps(p)
+#define CONV_STORE(p, v)    _mm512_storeu_ps(p, v)
+#define CONV_MADD(a, b, c)  _mm512_fmadd_ps(a, b, c)
+#elif defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define CONV_LANES          8
+#define CONV_VEC            __m256
+#define CONV_ZERO()         _mm256_setzero_ps()
+#define CONV_SET1(x)        _mm256_set1_ps(x)
+#define CONV_LOAD(p)        _mm256_loadu_ps(p)
+#define CONV_STORE(p, v)    _mm256_storeu_ps(p, v)
+#define CONV_MADD(a, b, c)  _mm256_fmadd_ps(a, b, c)
+#endif
+
+#define CONV_MIN_BAND_ROWS  16      // don't split images into thinner bands
+
+static int convolveThreads = 0;     // 0 = one per core
+
+void SetConvolveThreads(int nThreads)
+{
+    convolveThreads = __max(0, nThreads);
+}
 
 static int TrimIndex(int k, EBorderMode e, int n)
 {
@@ -51,177 +95,380 @@ static int TrimIndex(int k, EBorderMode e, int n)
     throw CError("Convolve[Separable]: %d is not a valid borderMode", int(e));
 }
 
+static int TrimIndex(int k, EBorderMode e, int n, int interpolate)
+{
+    // Source index of pixel k of the zero-inserted (interpolate times
+    // larger) image, or -1 for an inserted zero; the border is extended
+    // on the source image, so a replicated edge stays constant
+    int r = (k % interpolate + interpolate) % interpolate;
+    if (r != 0)
+        return -1;
+    k = (k - r) / interpolate;
+    return (0 <= k && k < n) ? k : TrimIndex(k, e, n);
+}
+
 template <class T>
-static void FillRowBuffer(float buf[], CImageOf<T>& src, CFloatImage& kernel,
-                          int k, int n)
+static bool FillRowBuffer(float buf[], CImageOf<T>& src, int xOrigin,
+                          int k, int n, int interpolate)
 {
-    // Compute the real row address
+    // Fill buf[0..n) with source row k (which may lie outside the image),
+    // starting at column xOrigin.  With interpolate > 1 the source is
+    // seen through zero insertion, i.e., as an image interpolate times
+    // larger whose only non-zero pixels are at multiples of interpolate.
+    // Returns false if the whole row is zero.
     CShape sShape = src.Shape();
     int nB = sShape.nBands;
-    int k0 = TrimIndex(k + kernel.origin[1], src.borderMode, sShape.height);
+    int sW = sShape.width;
+    int k0 = TrimIndex(k, src.borderMode, sShape.height, interpolate);
     if (k0 < 0)
     {
         memset(buf, 0, n * sizeof(float));
-        return;
+        return false;
     }
 
-    // Fill the row
-    T* srcP = &src.Pixel(0, k0, 0);
+    // Fill the row: the interior is a straight conversion, only the
+    // border pixels need TrimIndex
+    T* srcP = src.Row(k0).Data();
     int m = n / nB;
     for (int l = 0; l < m; l++, buf += nB)
     {
-        int l0 = TrimIndex(l + kernel.origin[0], src.borderMode, sShape.width);
+        int l0 = l + xOrigin;
+        if (interpolate == 1 && l0 >= 0 && l0 < sW)
+        {
+            int l1 = __min(m, sW - xOrigin);    // end of the interior
+            int cnt = (l1 - l) * nB;
+            T* p = &srcP[l0*nB];
+            for (int i = 0; i < cnt; i++)
+                buf[i] = (float) p[i];
+            buf += cnt - nB;
+            l = l1 - 1;
+            continue;
+        }
+        l0 = TrimIndex(l0, src.borderMode, sW, interpolate);
         if (l0 < 0)
-            memset(buf, 0, nB * sizeof(T));
+            memset(buf, 0, nB * sizeof(float));
         else
             for (int b = 0; b < nB; b++)
                 buf[b] = (float)srcP[l0*nB + b];
     }
+    return true;
 }
 
-static
-void ConvolveRow2D(CFloatImage& buffer, CFloatImage& kernel, float dst[],
-                   int n)
+template <int KX>
+static void ConvolveRowN(float* rows[], const float kern[], int kX, int kY,
+                         int nB, float dst[], int n)
 {
-    CShape kShape = kernel.Shape();
-    int kX  = kShape.width;
-    int kY  = kShape.height;
-    CShape bShape = buffer.Shape();
-    int nB  = bShape.nBands;
-
-    for (int i = 0; i < n; i++)
+    // dst[j] = sum_k sum_l kern[k*kX + l] * rows[k][j + l*nB]
+    // (KX > 0 fixes the kernel width at compile time, so the tap loop
+    //  is unrolled and the accumulator stays in a register)
+    const int nX = (KX > 0) ? KX : kX;
+    int j = 0;
+#ifdef CONV_LANES
+    for (; j + CONV_LANES <= n; j += CONV_LANES)
     {
-        for (int b = 0; b < nB; b++)
+        CONV_VEC sum = CONV_ZERO();
+        for (int k = 0; k < kY; k++)
         {
-            float sum = 0.0f;
-            for (int k = 0; k < kY; k++)
-            {
-                float* kPtr = &kernel.Pixel(0, k, 0);
-                float* bPtr = &buffer.Pixel(i, k, b);
-                for (int l = 0; l < kX; l++, bPtr += nB)
-                    sum += kPtr[l] * bPtr[0];
-            }
-            *dst++ = sum;
+            const float* kPtr = &kern[k * nX];
+            const float* bPtr = &rows[k][j];
+            for (int l = 0; l < nX; l++)
+                sum = CONV_MADD(CONV_SET1(kPtr[l]), CONV_LOAD(&bPtr[l * nB]), sum);
         }
+        CONV_STORE(&dst[j], sum);
+    }
+#endif
+    for (; j < n; j++)
+    {
+        float sum = 0.0f;
+        for (int k = 0; k < kY; k++)
+        {
+            const float* kPtr = &kern[k * nX];
+            const float* bPtr = &rows[k][j];
+            for (int l = 0; l < nX; l++)
+                sum += kPtr[l] * bPtr[l * nB];
+        }
+        dst[j] = sum;
     }
 }
 
-template <class T>
-void Convolve(CImageOf<T> src, CImageOf<T>& dst,
-              CFloatImage kernel,
-              float scale, float offset)
+static
+void ConvolveRow2D(float* rows[], const float kern[], int kX, int kY,
+                   int nB, float dst[], int n)
+{
+    // Dispatch the common small kernel widths (1 = vertical pass)
+    switch (kX)
+    {
+    case 1:  ConvolveRowN<1>(rows, kern, kX, kY, nB, dst, n); break;
+    case 3:  ConvolveRowN<3>(rows, kern, kX, kY, nB, dst, n); break;
+    case 5:  ConvolveRowN<5>(rows, kern, kX, kY, nB, dst, n); break;
+    case 7:  ConvolveRowN<7>(rows, kern, kX, kY, nB, dst, n); break;
+    default: ConvolveRowN<0>(rows, kern, kX, kY, nB, dst, n); break;
+    }
+}
+
+static std::vector<float> KernelTaps(CFloatImage& kernel, float gain)
 {
-    // Determine the shape of the kernel and row buffer
+    // Kernel coefficients as one contiguous array (kernel rows are padded)
     CShape kShape = kernel.Shape();
+    std::vector<float> taps(kShape.width * kShape.height);
+    for (int k = 0; k < kShape.height; k++)
+        for (int l = 0; l < kShape.width; l++)
+            taps[k * kShape.width + l] = gain * kernel.Row(k)[l];
+    return taps;
+}
+
+template <class T>
+static bool SharesMemory(CImageOf<T>& a, CImageOf<T>& b)
+{
+    // Do the pixels of a and b overlap?
+    CShape aS = a.Shape(), bS = b.Shape();
+    if (aS.width * aS.height * aS.nBands == 0 ||
+        bS.width * bS.height * bS.nBands == 0)
+        return false;
+    char* a0 = (char *) &a.Pixel(0, 0, 0);
+    char* a1 = (char *) &a.Pixel(aS.width-1, aS.height-1, aS.nBands-1);
+    char* b0 = (char *) &b.Pixel(0, 0, 0);
+    char* b1 = (char *) &b.Pixel(bS.width-1, bS.height-1, bS.nBands-1);
+    return a0 <= b1 && b0 <= a1;
+}
+
+template <class T>
+static CImageOf<T> PrivateCopy(CImageOf<T>& src)
+{
+    // Copy of src in its own memory (keeps the border mode and origin)
     CShape sShape = src.Shape();
-    CShape bShape(sShape.width + kShape.width, kShape.height, sShape.nBands);
-    int bWidth = bShape.width * bShape.nBands;
+    CImageOf<T> copy(sShape);
+    copy.borderMode = src.borderMode;
+    copy.origin[0]  = src.origin[0];
+    copy.origin[1]  = src.origin[1];
+    for (int y = 0; y < sShape.height; y++)
+        memcpy(copy.Row(y).Data(), src.Row(y).Data(),
+               src.Row(y).Size() * sizeof(T));
+    return copy;
+}
 
-    // Allocate the result, if necessary, and the row buffer
-    dst.ReAllocate(sShape, false);
-    CFloatImage buffer(bShape);
-    if (sShape.width * sShape.height * sShape.nBands == 0)
+template <class F>
+static void ForEachRowBand(int height, int nPixels, F band)
+{
+    // Run band(y0, y1) over horizontal bands of [0, height), one per
+    // thread; small images are done on the calling thread
+    int nThreads = convolveThreads ? convolveThreads :
+                   (int) std::thread::hardware_concurrency();
+    nThreads = __min(nThreads, height / CONV_MIN_BAND_ROWS);
+    if (nPixels < (1 << 16))
+        nThreads = 1;
+    if (nThreads <= 1)
+    {
+        band(0, height);
         return;
-    CFloatImage output(CShape(sShape.width, 1, sShape.nBands));
-
-    // Fill up the row buffer initially
-    for (int k = 0; k < kShape.height; k++)
-        FillRowBuffer(&buffer.Pixel(0, k, 0), src, kernel, k, bWidth);
+    }
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nThreads; t++)
+        threads.push_back(std::thread(band, height * t / nThreads,
+                                      height * (t+1) / nThreads));
+    band(0, height / nThreads);
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+}
 
+template <class T>
+static void ClipRange(CImageOf<T>& dst, T& minVal, T& maxVal)
+{
     // Determine if clipping is required
     //  (we assume up-conversion to float never requires clipping, i.e.,
     //   floats have the highest dynamic range)
-    T minVal = dst.MinVal();
-    T maxVal = dst.MaxVal();
-    if (minVal <= buffer.MinVal() && maxVal >= buffer.MaxVal())
+    CFloatImage floatImg;
+    minVal = dst.MinVal();
+    maxVal = dst.MaxVal();
+    if (minVal <= floatImg.MinVal() && maxVal >= floatImg.MaxVal())
         minVal = maxVal = 0;
+}
+
+template <class T>
+static void ConvolveBand(CImageOf<T>& src, CImageOf<T>& dst,
+                         CFloatImage& kernel, const float kern[],
+                         float scale, float offset, T minVal, T maxVal,
+                         int y0, int y1)
+{
+    // Convolve output rows [y0, y1).  The kY buffer lines are used as a
+    // ring: source line y+k lives in line (y+k) % kY, so moving down one
+    // row refills a single line instead of shifting the whole buffer.
+    CShape kShape = kernel.Shape();
+    CShape sShape = src.Shape();
+    int kX = kShape.width, kY = kShape.height;
+    int nB = sShape.nBands;
+    int n  = sShape.width * nB;
+    CShape bShape(sShape.width + kX, kY, nB);
+    int bWidth = bShape.width * nB;
+    CFloatImage buffer(bShape);
+    CFloatImage output(CShape(sShape.width, 1, nB));
+    std::vector<float*> rows(kY);
+
+    // Fill up the row buffer initially
+    for (int k = 0; k < kY; k++)
+        FillRowBuffer(buffer.Row((y0+k) % kY).Data(), src, kernel.origin[0],
+                      y0 + k + kernel.origin[1], bWidth, 1);
 
     // Process each row
-    for (int y = 0; y < sShape.height; y++)
+    for (int y = y0; y < y1; y++)
     {
         // Do the convolution
-        ConvolveRow2D(buffer, kernel, &output.Pixel(0, 0, 0),
-                      sShape.width);
+        for (int k = 0; k < kY; k++)
+            rows[k] = buffer.Row((y+k) % kY).Data();
+        ConvolveRow2D(&rows[0], kern, kX, kY, nB, output.Row(0).Data(), n);
 
         // Scale, offset, and type convert
-        ScaleAndOffsetLine(&output.Pixel(0, 0, 0), &dst.Pixel(0, y, 0),
-                           sShape.width * sShape.nBands,
+        ScaleAndOffsetLine(output.Row(0).Data(), dst.Row(y).Data(), n,
                            scale, offset, minVal, maxVal);
 
-        // Shift up the row buffer and fill the last line
-        if (y < sShape.height-1)
-        {
-            int k;
-            for (k = 0; k < kShape.height-1; k++)
-                memcpy(&buffer.Pixel(0, k, 0), &buffer.Pixel(0, k+1, 0),
-                       bWidth * sizeof(float));
-            FillRowBuffer(&buffer.Pixel(0, k, 0), src, kernel, y+k+1, bWidth);
-        }
+        // Replace the line just retired (source line y) with line y+kY
+        if (y < y1-1)
+            FillRowBuffer(buffer.Row(y % kY).Data(), src, kernel.origin[0],
+                          y + kY + kernel.origin[1], bWidth, 1);
     }
 }
 
 template <class T>
-void ConvolveSeparable(CImageOf<T> src, CImageOf<T>& dst,
-                       CFloatImage x_kernel, CFloatImage y_kernel,
-                       float scale, float offset,
-                       int decimate, int interpolate)
+void Convolve(CImageOf<T> src, CImageOf<T>& dst,
+              CFloatImage kernel,
+              float scale, float offset)
 {
     // Allocate the result, if necessary
-    CShape dShape = src.Shape();
-    if (decimate > 1)
-    {
-        dShape.width  = (dShape.width  + decimate-1) / decimate;
-        dShape.height = (dShape.height + decimate-1) / decimate;
-    }
-    dst.ReAllocate(dShape, false);
+    CShape sShape = src.Shape();
+    dst.ReAllocate(sShape, false);
+    if (sShape.width * sShape.height * sShape.nBands == 0)
+        return;
+
+    // In place: bands (and the bottom border rows) would read pixels
+    // that are already overwritten, so work from a copy
+    if (SharesMemory(src, dst))
+        src = PrivateCopy(src);
 
-    // Allocate the intermediate images
-    CImageOf<T> tmpImg1(src.Shape());
-    CImageOf<T> tmpImg2(src.Shape());
+    std::vector<float> kern = KernelTaps(kernel, 1.0f);
+    T minVal, maxVal;
+    ClipRange(dst, minVal, maxVal);
 
-    // Create a proper vertical convolution kernel
-    CFloatImage v_kernel(1, y_kernel.Shape().width, 1);
-    for (int k = 0; k < y_kernel.Shape().width; k++)
-        v_kernel.Pixel(0, k, 0) = y_kernel.Pixel(k, 0, 0);
-    v_kernel.origin[1] = y_kernel.origin[0];
+    ForEachRowBand(sShape.height, sShape.width * sShape.height,
+        [&](int y0, int y1) {
+            ConvolveBand(src, dst, kernel, &kern[0], scale, offset,
+                         minVal, maxVal, y0, y1);
+        });
+}
 
-    // Perform the two convolutions
-    Convolve(src, tmpImg1, x_kernel, 1.0f, 0.0f);
-    Convolve(tmpImg1, tmpImg2, v_kernel, scale, offset);
+template <class T>
+static void SeparableBand(CImageOf<T>& src, CImageOf<T>& dst,
+                          CFloatImage& x_kernel, CFloatImage& y_kernel,
+                          const float xKern[], const float yKern[],
+                          float scale, float offset, T minVal, T maxVal,
+                          int decimate, int interpolate, int y0, int y1)
+{
+    // Output rows [y0, y1) of the separable convolution.  Horizontally
+    // filtered (and decimated) source rows are kept in a ring of kY lines
+    // indexed by (virtual) source row, so each one is computed once per
+    // band, and only the output rows are filtered vertically.
+    CShape sShape = src.Shape();
+    CShape dShape = dst.Shape();
+    int kX = x_kernel.Shape().width, kY = y_kernel.Shape().width;
+    int nB = sShape.nBands;
+    int uW = sShape.width * interpolate;        // (virtual) input width
+    int n  = dShape.width * nB;
+    CFloatImage padded(CShape(uW + kX, 1, nB));
+    CFloatImage filtered(CShape(uW, 1, nB));
+    CFloatImage ring(CShape(dShape.width, kY, nB));
+    CFloatImage output(CShape(dShape.width, 1, nB));
+    std::vector<int> ringRow(kY, INT_MIN);
+    std::vector<float*> rows(kY);
+    float* pRow = padded.Row(0).Data();
 
-    // Downsample or copy
-    for (int y = 0; y < dShape.height; y++)
+    for (int y = y0; y < y1; y++)
     {
-        T* sPtr = &tmpImg2.Pixel(0, y * decimate, 0);
-        T* dPtr = &dst.Pixel(0, y, 0);
-        int nB  = dShape.nBands;
-        for (int x = 0; x < dShape.width; x++)
+        for (int k = 0; k < kY; k++)
         {
-            for (int b = 0; b < nB; b++)
-                dPtr[b] = sPtr[b];
-            sPtr += decimate * nB;
-            dPtr += nB;
+            int v = y * decimate + k + y_kernel.origin[0];
+            int s = (v % kY + kY) % kY;
+            float* line = ring.Row(s).Data();
+            rows[k] = line;
+            if (ringRow[s] == v)
+                continue;
+            ringRow[s] = v;
+
+            // Horizontal pass over source row v, then keep every
+            // decimate'th column
+            if (! FillRowBuffer(pRow, src, x_kernel.origin[0], v,
+                                (uW + kX) * nB, interpolate))
+            {
+                memset(line, 0, n * sizeof(float));
+                continue;
+            }
+            if (decimate == 1)
+            {
+                ConvolveRow2D(&pRow, xKern, kX, 1, nB, line, n);
+                continue;
+            }
+            float* full = filtered.Row(0).Data();
+            ConvolveRow2D(&pRow, xKern, kX, 1, nB, full, uW * nB);
+            for (int x = 0; x < dShape.width; x++)
+                for (int b = 0; b < nB; b++)
+                    line[x*nB + b] = full[x*decimate*nB + b];
         }
-    }
 
-    interpolate++; // to get rid of "unused parameter" warning
+        // Vertical pass and conversion
+        ConvolveRow2D(&rows[0], yKern, 1, kY, nB, output.Row(0).Data(), n);
+        ScaleAndOffsetLine(output.Row(0).Data(), dst.Row(y).Data(), n,
+                           scale, offset, minVal, maxVal);
+    }
 }
 
 template <class T>
-void InstantiateConvolutionOf(CImageOf<T> img)
+void ConvolveSeparable(CImageOf<T> src, CImageOf<T>& dst,
+                       CFloatImage x_kernel, CFloatImage y_kernel,
+                       float scale, float offset,
+                       int decimate, int interpolate)
 {
-    CFloatImage kernel;
-    Convolve(img, img, kernel, 1.0, 0.0);
-    ConvolveSeparable(img, img, kernel, kernel, 1.0, 0.0, 1, 1);
-}
+    // Allocate the result, if necessary
+    decimate    = __max(1, decimate);
+    interpolate = __max(1, interpolate);
+    CShape dShape = src.Shape();
+    dShape.width  = (dShape.width  * interpolate + decimate-1) / decimate;
+    dShape.height = (dShape.height * interpolate + decimate-1) / decimate;
+    dst.ReAllocate(dShape, false);
+    if (dShape.width * dShape.height * dShape.nBands == 0)
+        return;
 
-void InstantiateConvolutions()
-{
-    InstantiateConvolutionOf(CByteImage());
-    InstantiateConvolutionOf(CIntImage());
-    InstantiateConvolutionOf(CFloatImage());
+    if (SharesMemory(src, dst))
+        src = PrivateCopy(src);
+
+    // Zero insertion scales the DC gain of each 1-D pass by 1/interpolate
+    std::vector<float> xKern = KernelTaps(x_kernel, (float) interpolate);
+    std::vector<float> yKern = KernelTaps(y_kernel, (float) interpolate);
+    T minVal, maxVal;
+    ClipRange(dst, minVal, maxVal);
+
+    ForEachRowBand(dShape.height, dShape.width * dShape.height,
+        [&](int y0, int y1) {
+            SeparableBand(src, dst, x_kernel, y_kernel, &xKern[0], &yKern[0],
+                          scale, offset, minVal, maxVal,
+                          decimate, interpolate, y0, y1);
+        });
 }
 
+//
+//  Explicit instantiations (the templates are only defined in this file,
+//  and an implicit instantiation may be inlined away entirely)
+//
+
+#define INSTANTIATE_CONVOLUTION(T)                                      \
+template void Convolve(CImageOf<T> src, CImageOf<T>& dst,               \
+                       CFloatImage kernel, float scale, float offset);  \
+template void ConvolveSeparable(CImageOf<T> src, CImageOf<T>& dst,      \
+                                CFloatImage x_kernel, CFloatImage y_kernel, \
+                                float scale, float offset,              \
+                                int decimate, int interpolate);
+
+INSTANTIATE_CONVOLUTION(uchar)
+INSTANTIATE_CONVOLUTION(int)
+INSTANTIATE_CONVOLUTION(float)
+
 //
 //  Default kernels
 //
@@ -6,19 +6,24 @@
 // SPECIFICATION
 //  void Convolve(CImageOf<T> src, CImageOf<T>& dst,
 //                CFloatImage kernel,
-//                int decimate, int interpolate);
+//                float scale, float offset);
 //
 //  void ConvolveSeparable(CImageOf<T> src, CImageOf<T>& dst,
 //                         CFloatImage xKernel, CFloatImage yKernel,
+//                         float scale, float offset,
 //                         int decimate, int interpolate);
 //
+//  void SetConvolveThreads(int nThreads);
+//
 // PARAMETERS
 //  src                 source image
 //  dst                 destination image
 //  kernel              2-D convolution kernel
 //  xKernel, yKernel    1-D convolution kernels (1-row images)
+//  scale, offset       applied to the result before type conversion
 //  decimate            decimation factor (1 = none, 2 = half, ...)
 //  interpolate			interpolation factor (1 = none, 2 = double, ...)
+//  nThreads            threads used for large images (0 = one per core)
 //
 // DESCRIPTION
 //  Perform a 2D or separable 1D convolution.  The convolution kernels
@@ -27,9 +32,17 @@
 //  by the kernel.origin[] parameters, which specify the offset (coordinate,
 //  usually negative) of the first (top-left) pixel in the kernel.
 //
-//  Because a temporary row buffer is used for row padding and separable
-//  convolution intermediaries, the src and dst images can be the same
-//  (in place convolution), so long as decimation = interpolation = 1.
+//  Interpolation inserts interpolate-1 zeros between the source pixels
+//  (in both directions) and then convolves, so xKernel and yKernel act
+//  as the interpolation filter; the kernels are scaled by interpolate
+//  to keep the DC gain (e.g., ConvolveKernel_121 gives bilinear
+//  doubling).  Decimation keeps every decimate'th pixel of the filtered
+//  (and interpolated) result.
+//
+//  The src and dst images can be the same (in place convolution); the
+//  source is then copied first.
+//
+//  Large images are processed in horizontal bands by several threads.
 //
 //  If dst is not of the right shape, it is reallocated to the right shape.
 //
@@ -57,6 +70,8 @@ void ConvolveSeparable(CImageOf<T> src, CImageOf<T>& dst,
                        float scale, float offset,
                        int decimate, int interpolate);
 
+void SetConvolveThreads(int nThreads);
+
 extern CFloatImage ConvolveKernel_121;
 extern CFloatImage ConvolveKernel_14641;
 extern CFloatImage ConvolveKernel_8TapLowPass;
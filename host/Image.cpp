@@ -12,7 +12,9 @@
 ///////////////////////////////////////////////////////////////////////////
 
 #include "Image.h"
+#include "ImagePool.h"
 #include "Error.h"
+#include <utility>
 
 //
 // struct CShape: shape of image (width x height x nbands)
@@ -73,6 +75,40 @@ CImage::CImage(CShape s, const type_info& ti, int cS)
     ReAllocate(s, ti, cS, 0, true, 0);
 }
 
+CImage::CImage(CImage&& ref)
+{
+    // Move constructor
+    MoveFrom(ref);
+}
+
+CImage& CImage::operator=(CImage&& ref)
+{
+    // Move assignment
+    if (this != &ref)
+        MoveFrom(ref);
+    return *this;
+}
+
+void CImage::MoveFrom(CImage& ref)
+{
+    // Take over ref's memory and state, leaving ref an empty image
+    // of the same pixel type (so it can be ReAllocate()d again)
+    CImageAttributes::operator=(ref);
+    alphaChannel = ref.alphaChannel;
+    m_shape     = ref.m_shape;
+    m_pTI       = ref.m_pTI;
+    m_bandSize  = ref.m_bandSize;
+    m_pixSize   = ref.m_pixSize;
+    m_rowSize   = ref.m_rowSize;
+    m_memStart  = ref.m_memStart;
+    m_memory    = std::move(ref.m_memory);
+
+    ref.m_shape     = CShape();
+    ref.m_pixSize   = 0;
+    ref.m_rowSize   = 0;
+    ref.m_memStart  = 0;
+}
+
 void CImage::ReAllocate(CShape s, const type_info& ti, int bandSize,
                         bool evenIfSameShape)
 {
@@ -82,7 +118,9 @@ void CImage::ReAllocate(CShape s, const type_info& ti, int bandSize,
 }
 
 void CImage::ReAllocate(CShape s, const type_info& ti, int bandSize,
-                        void *memory, bool deleteWhenDone, int rowSize)
+                        void *memory, bool deleteWhenDone, int rowSize,
+                        void (*deleteFunction)(void *ptr),
+                        void *deleteArg)
 {
     // Set up the type_id, shape, and size info
     m_shape     = s;                        // image shape (dimensions)
@@ -92,16 +130,18 @@ void CImage::ReAllocate(CShape s, const type_info& ti, int bandSize,
 
     // Do the real allocation work
     m_rowSize   = (rowSize) ? rowSize :     // stride between rows in bytes
-        (m_pixSize * s.width + 7) & -8;     // round up to 8 (quadwords)
+        ImagePoolRowPitch(m_pixSize * s.width, s.height);   // aligned, padded off 4 KB
     int nBytes  = m_rowSize * s.height;
     if (memory == 0 && nBytes > 0)          // allocate if necessary
     {
-        memory = new double[(nBytes + 7)/ 8];
+        memory = ImagePoolAllocate(nBytes);
         if (memory == 0)
             throw CError("CImage::Reallocate: could not allocate %d bytes", nBytes);
+        deleteFunction = ImagePoolRelease;  // hand it back to the pool
+        deleteArg = 0;
     }
     m_memStart = (char *) memory;           // start of addressable memory
-    m_memory.ReAllocate(nBytes, memory, deleteWhenDone);
+    m_memory.ReAllocate(nBytes, memory, deleteWhenDone, deleteFunction, deleteArg);
 }
 
 void CImage::DeAllocate()
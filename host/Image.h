@@ -15,15 +15,23 @@
 //  number of bands (channels) per pixel.  For example, traditional RGBA
 //  images can be represented using a 4-channel unsigned_8 image.
 //
+//  Pixel memory comes from an aligned, recycling pool (ImagePool.h):
+//  every row starts on a 64-byte boundary and row pitches that are a
+//  multiple of 4 KB are padded, so rows are NOT contiguous in general
+//  (use PixelAddress() per row rather than assuming width * pixSize).
+//
 //  Images are normally allocated on the stack (NOT on the heap, i.e.,
 //  "new Image" should not be used).  They can be freely returned from
 //  functions and put into other data structures.  Assignment and copy
 //  construction share memory (to copy pixel values from one image to
-//  another one, use CopyPixels()).
+//  another one, use CopyPixels()).  Moving an image hands its memory
+//  over without touching the reference count (useful for passing images
+//  between threads) and leaves the source empty but still typed.
 //
 // SEE ALSO
 //  Image.cpp           implementation
 //  RefCntMem.h         reference-counted memory object used by CImage
+//  ImagePool.h         aligned, recycling allocator behind CImage
 //
 // Copyright  Richard Szeliski, 2001.
 // See Copyright.h for more details
@@ -117,10 +125,16 @@ class CImage : public CImageAttributes
 public:
     CImage(void);               // default constructor
     CImage(CShape s, const type_info& ti, int bandSize);
-    // uses system-supplied copy constructor, assignment operator, and destructor
+    CImage(const CImage& ref) = default;            // shares memory
+    CImage& operator=(const CImage& ref) = default; // shares memory
+    CImage(CImage&& ref);           // takes over memory, ref is left empty
+    CImage& operator=(CImage&& ref);    // takes over memory, ref is left empty
+    // uses system-supplied destructor
 
     void ReAllocate(CShape s, const type_info& ti, int bandSize,
-                    void *memory, bool deleteWhenDone, int rowSize);
+                    void *memory, bool deleteWhenDone, int rowSize,
+                    void (*deleteFunction)(void *ptr) = 0,
+                    void *deleteArg = 0);
     void ReAllocate(CShape s, const type_info& ti, int bandSize,
                     bool evenIfSameShape = false);
     void DeAllocate(void);      // release the memory & set to default values
@@ -128,6 +142,7 @@ public:
     CShape Shape(void)              { return m_shape; }
     const type_info& PixType(void)  { return *m_pTI; }
     int BandSize(void)              { return m_bandSize; }
+    int RowSize(void)               { return m_rowSize; }
 
     void* PixelAddress(int x, int y, int band);
 
@@ -138,6 +153,7 @@ protected:
 
 private:
     void SetDefaults(void); // set internal state to default values
+    void MoveFrom(CImage& ref); // take over ref's state, leave it empty
 
     CShape m_shape;         // image shape (dimensions)
     const type_info* m_pTI; // pointer to type_info class
@@ -157,6 +173,70 @@ inline void* CImage::PixelAddress(int x, int y, int band)
 }
 
 
+//  Row and band views of a strongly typed image (see CImageOf<T>::Row()
+//  and CImageOf<T>::Band()).  The views do not hold a reference to the
+//  image memory, so they must not outlive the image they came from.
+
+template <class T>
+class CStridedSpan          // count values, stride values apart
+{
+public:
+    class iterator
+    {
+    public:
+        iterator(T* ptr, int stride) : m_ptr(ptr), m_stride(stride) {}
+        T& operator*() const                { return *m_ptr; }
+        iterator& operator++()              { m_ptr += m_stride; return *this; }
+        bool operator!=(const iterator& it) const { return m_ptr != it.m_ptr; }
+        bool operator==(const iterator& it) const { return m_ptr == it.m_ptr; }
+    private:
+        T* m_ptr;
+        int m_stride;
+    };
+
+    CStridedSpan(T* data, int count, int stride) :
+        m_data(data), m_count(count), m_stride(stride) {}
+
+    T* Data(void) const                 { return m_data; }
+    int Size(void) const                { return m_count; }
+    int Stride(void) const              { return m_stride; }   // in values, not bytes
+    T& operator[](int i) const          { return m_data[i * m_stride]; }
+    iterator begin(void) const          { return iterator(m_data, m_stride); }
+    iterator end(void) const            { return iterator(m_data + m_count * m_stride, m_stride); }
+
+private:
+    T* m_data;
+    int m_count;
+    int m_stride;
+};
+
+template <class T>
+class CRowSpan              // one row: width pixels of nBands interleaved values
+{
+public:
+    CRowSpan(T* data, int width, int nBands) :
+        m_data(data), m_width(width), m_nBands(nBands) {}
+
+    // The values of a row are always contiguous, so Data()[x*nBands + band]
+    //  is pixel (x, band) and loops over [begin(), end()) vectorize
+    T* Data(void) const                 { return m_data; }
+    int Size(void) const                { return m_width * m_nBands; }
+    int Width(void) const               { return m_width; }
+    int NBands(void) const              { return m_nBands; }
+    T& operator[](int i) const          { return m_data[i]; }
+    T* Pixel(int x) const               { return &m_data[x * m_nBands]; }
+    CStridedSpan<T> Band(int band) const
+        { return CStridedSpan<T>(&m_data[band], m_width, m_nBands); }
+    T* begin(void) const                { return m_data; }
+    T* end(void) const                  { return m_data + m_width * m_nBands; }
+
+private:
+    T* m_data;
+    int m_width;
+    int m_nBands;
+};
+
+
 //  Strongly typed image
 
 template <class T>
@@ -166,12 +246,20 @@ public:
     CImageOf(void);
     CImageOf(CShape s);
     CImageOf(int width, int height, int nBands);
-    // uses system-supplied copy constructor, assignment operator, and destructor
+    CImageOf(const CImageOf& ref) = default;
+    CImageOf& operator=(const CImageOf& ref) = default;
+    CImageOf(CImageOf&& ref) = default;
+    CImageOf& operator=(CImageOf&& ref) = default;
+    // uses system-supplied destructor
 
     void ReAllocate(CShape s, bool evenIfSameShape = false);
-    void ReAllocate(CShape s, T *memory, bool deleteWhenDone, int rowSize);
+    void ReAllocate(CShape s, T *memory, bool deleteWhenDone, int rowSize,
+                    void (*deleteFunction)(void *ptr) = 0,
+                    void *deleteArg = 0);
 
     T& Pixel(int x, int y, int band);
+    CRowSpan<T> Row(int y);                 // all values of row y
+    CStridedSpan<T> Band(int y, int band);  // one band of row y
 
     CImageOf SubImage(int x, int y, int width, int height);   // sub-image sharing memory
 
@@ -204,9 +292,12 @@ inline void CImageOf<T>::ReAllocate(CShape s, bool evenIfSameShape)
 
 template <class T>
 inline void CImageOf<T>::ReAllocate(CShape s, T *memory,
-                                    bool deleteWhenDone, int rowSize)
+                                    bool deleteWhenDone, int rowSize,
+                                    void (*deleteFunction)(void *ptr),
+                                    void *deleteArg)
 {
-    CImage::ReAllocate(s, typeid(T), sizeof(T), memory, deleteWhenDone, rowSize);
+    CImage::ReAllocate(s, typeid(T), sizeof(T), memory, deleteWhenDone, rowSize,
+                       deleteFunction, deleteArg);
 }
     
 template <class T>
@@ -215,6 +306,20 @@ inline T& CImageOf<T>::Pixel(int x, int y, int band)
     return *(T *) PixelAddress(x, y, band);
 }
 
+template <class T>
+inline CRowSpan<T> CImageOf<T>::Row(int y)
+{
+    CShape s = Shape();
+    return CRowSpan<T>((T *) PixelAddress(0, y, 0), s.width, s.nBands);
+}
+
+template <class T>
+inline CStridedSpan<T> CImageOf<T>::Band(int y, int band)
+{
+    CShape s = Shape();
+    return CStridedSpan<T>((T *) PixelAddress(0, y, band), s.width, s.nBands);
+}
+
 template <class T>
 inline CImageOf<T> CImageOf<T>::SubImage(int x, int y, int width, int height)
 {
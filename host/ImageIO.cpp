@@ -13,6 +13,7 @@
 //  - PMF (multiband float) - homegrown, non-standard
 //        (PFM already taken by postscript font maps)
 //  - PNG (requires ImageIOpng.cpp, and pnglib and zlib packages)
+//  - YUV4MPEG2 and raw planar video, luma only (CLumaStream)
 //
 // SEE ALSO
 //  ImageIO.h            longer description
@@ -26,7 +27,16 @@
 #include "Image.h"
 #include "Error.h"
 #include "ImageIO.h"
+#include "Convert.h"
 #include <vector>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 // Comment out next line if you don't have the PNG library
 //#define HAVE_PNG_LIB
@@ -512,9 +522,397 @@ void WriteFilePGM(CByteImage img, const char* filename)
 
 
 //
-// main dispatch functions
+// Fast gray ingestion: map PGM/PPM files and convert RGB straight to luma
+//
+
+static const uchar* MapFile(const char* filename, size_t& nBytes)
+{
+    // map a whole file read-only; release with munmap(ptr, nBytes)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        throw CError("MapFile: could not open %s", filename);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        throw CError("MapFile: could not stat or empty file %s", filename);
+    }
+    nBytes = st.st_size;
+    void *ptr = mmap(0, nBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        throw CError("MapFile: could not map %s", filename);
+    madvise(ptr, nBytes, MADV_SEQUENTIAL);
+    return (const uchar *) ptr;
+}
+
+// a file from MapFile, unmapped when it goes out of scope (also when a
+// parse error throws)
+struct CMappedFile
+{
+    const uchar *start;
+    size_t nBytes;
+
+    CMappedFile(const char* filename) { start = MapFile(filename, nBytes); }
+    ~CMappedFile() { munmap((void *) start, nBytes); }
+
+private:
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+};
+
+static const uchar* skip_space_comment(const uchar* p, const uchar* end)
+{
+    // skip white space and comment lines in the header of a mapped pnm file
+    while (p < end)
+    {
+        if (*p == '#')
+            while (p < end && *p != '\n')
+                p++;
+        else if (*p == '\n' || *p == ' ' || *p == '\t' || *p == '\r')
+            p++;
+        else
+            break;
+    }
+    return p;
+}
+
+static const uchar* read_int(const uchar* p, const uchar* end, int *val)
+{
+    // parse a positive decimal number in the header of a mapped pnm file
+    p = skip_space_comment(p, end);
+    if (p == end || *p < '0' || *p > '9')
+        throw CError("ReadImageGray: number expected in pnm header");
+    int v = 0;
+    while (p < end && *p >= '0' && *p <= '9' && v < 100000)
+        v = 10 * v + (*p++ - '0');
+    *val = v;
+    return p;
+}
+
+static void RGBToGrayLine(const uchar* src, uchar* dst, int n)
+{
+    // Convert n packed RGB triplets to luma using the ConvertToGray formula
+    //  Y = 0.299 * R + 0.587 * G + 0.114 * B in 15-bit fixed point
+    const int cR = 9798, cG = 19235, cB = 3735;
+    int x = 0;
+#ifdef __SSSE3__
+    // 16 pixels (48 bytes) per iteration: gather R, G and B with byte
+    // shuffles, then widen and accumulate R*cR + G*cG with one madd
+    const __m128i rA = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i rB = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i rC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i gA = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i gB = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i gC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i bA = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i bB = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i bC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    const __m128i kRG = _mm_set1_epi32(cR | (cG << 16));
+    const __m128i kB  = _mm_set1_epi32(cB);
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= n; x += 16, src += 48)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) (src));
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *) (src + 32));
+        __m128i R = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, rA), _mm_shuffle_epi8(b, rB)), _mm_shuffle_epi8(c, rC));
+        __m128i G = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, gA), _mm_shuffle_epi8(b, gB)), _mm_shuffle_epi8(c, gC));
+        __m128i B = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, bA), _mm_shuffle_epi8(b, bB)), _mm_shuffle_epi8(c, bC));
+
+        __m128i Y[2];
+        for (int h = 0; h < 2; h++)
+        {
+            __m128i R16 = h ? _mm_unpackhi_epi8(R, zero) : _mm_unpacklo_epi8(R, zero);
+            __m128i G16 = h ? _mm_unpackhi_epi8(G, zero) : _mm_unpacklo_epi8(G, zero);
+            __m128i B16 = h ? _mm_unpackhi_epi8(B, zero) : _mm_unpacklo_epi8(B, zero);
+            __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(R16, G16), kRG),
+                                       _mm_madd_epi16(_mm_unpacklo_epi16(B16, zero), kB));
+            __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(R16, G16), kRG),
+                                       _mm_madd_epi16(_mm_unpackhi_epi16(B16, zero), kB));
+            Y[h] = _mm_packs_epi32(_mm_srli_epi32(lo, 15), _mm_srli_epi32(hi, 15));
+        }
+        _mm_storeu_si128((__m128i *) (dst + x), _mm_packus_epi16(Y[0], Y[1]));
+    }
+#endif
+    for (; x < n; x++, src += 3)
+        dst[x] = (uchar) ((cR * src[0] + cG * src[1] + cB * src[2]) >> 15);
+}
+
+static void ReadFilePNMGray(CByteImage& img, const char* filename, bool isGray)
+{
+    // Map the file, parse the header once and decode rows straight into
+    // a 1-band image (PPM rows are converted to luma on the fly)
+    CMappedFile file(filename);
+    const uchar *end = file.start + file.nBytes;
+
+    int width, height, maxval;
+    const uchar *p = file.start;
+    if (file.nBytes < 2 || p[0] != 'P' || p[1] != (isGray ? '5' : '6'))
+        throw CError("ReadImageGray: wrong magic code for %s file", isGray ? "PGM" : "PPM");
+    p = read_int(p + 2, end, &width);
+    p = read_int(p, end, &height);
+    p = read_int(p, end, &maxval);
+    p++;    // single whitespace character after maxval
+
+    int n = isGray ? width : 3 * width;
+    if (maxval != 255 || p + (size_t) n * height > end)
+        throw CError("ReadImageGray(%s): file is too short or not 8-bit", filename);
+
+    CShape sh(width, height, 1);
+    img.ReAllocate(sh);
+
+    for (int y = 0; y < height; y++, p += n)
+    {
+        uchar* ptr = &img.Pixel(0, y, 0);
+        if (isGray)
+            memcpy(ptr, p, width);
+        else
+            RGBToGrayLine(p, ptr, width);
+    }
+}
+
+void ReadImageGray(CByteImage& img, const char* filename)
+{
+	if (filename == NULL)
+		throw CError("ReadImageGray: empty filename");
+
+    // Determine the file extension
+    const char *dot = strrchr(filename, '.');
+	if (dot == NULL)
+		throw CError("ReadImageGray: extension required in filename '%s'", filename);
+
+    if (strcmp(dot, ".pgm") == 0 || strcmp(dot, ".ppm") == 0)
+        ReadFilePNMGray(img, filename, strcmp(dot, ".pgm") == 0);
+    else
+    {
+        CByteImage tmpImg;
+        ReadImage(tmpImg, filename);
+        img = ConvertToGray(tmpImg);
+    }
+}
+
+
+//
+// Streaming luma input: YUV4MPEG2 and raw planar video
 //
 
+// A mapped video file, shared by the stream and every frame handed out
+// from it; unmapped when the last of them lets go
+struct CLumaMapping
+{
+    void *base;
+    size_t nBytes;
+    std::atomic<int> refCnt;
+};
+
+static void ReleaseLumaMapping(void *ptr)
+{
+    CLumaMapping *mapping = (CLumaMapping *) ptr;
+    if (mapping->refCnt.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        munmap(mapping->base, mapping->nBytes);
+        delete mapping;
+    }
+}
+
+CLumaStream::CLumaStream()
+{
+    m_stream = 0;
+    m_mapping = 0;
+    m_map = 0;
+    m_mapBytes = m_pos = 0;
+    m_isY4M = false;
+    m_width = m_height = 0;
+    m_chromaBytes = 0;
+}
+
+CLumaStream::~CLumaStream()
+{
+    Close();
+}
+
+void CLumaStream::Close()
+{
+    // Frames handed out from a mapping keep it alive
+    if (m_mapping)
+        ReleaseLumaMapping(m_mapping);
+    if (m_stream && m_stream != stdin)
+        fclose(m_stream);
+    m_stream = 0;
+    m_mapping = 0;
+    m_map = 0;
+    m_mapBytes = m_pos = 0;
+}
+
+void CLumaStream::ParseY4MHeader(const char* line, const char* filename)
+{
+    // Parse "YUV4MPEG2 W<w> H<h> ... C<colorspace>" (one line, no newline)
+    if (strncmp(line, "YUV4MPEG2 ", 10) != 0)
+        throw CError("CLumaStream: %s is not a YUV4MPEG2 stream", filename);
+
+    char cs[16] = "420";
+    for (const char* p = line + 9; *p; )
+    {
+        while (*p == ' ')
+            p++;
+        if (*p == 'W')
+            m_width = atoi(p + 1);
+        else if (*p == 'H')
+            m_height = atoi(p + 1);
+        else if (*p == 'C')
+            sscanf(p + 1, "%15s", cs);
+        p += strcspn(p, " ");
+    }
+    if (m_width < 1 || m_height < 1)
+        throw CError("CLumaStream(%s): missing frame size in header", filename);
+
+    // Chroma planes that follow each Y plane (8-bit samples only)
+    size_t cw = (m_width + 1) / 2, ch = (m_height + 1) / 2;
+    size_t wh = (size_t) m_width * m_height;
+    if (strcmp(cs, "420") == 0 || strcmp(cs, "420jpeg") == 0 ||
+        strcmp(cs, "420paldv") == 0 || strcmp(cs, "420mpeg2") == 0)
+        m_chromaBytes = 2 * cw * ch;
+    else if (strcmp(cs, "422") == 0)
+        m_chromaBytes = 2 * cw * m_height;
+    else if (strcmp(cs, "444") == 0)
+        m_chromaBytes = 2 * wh;
+    else if (strcmp(cs, "444alpha") == 0)
+        m_chromaBytes = 3 * wh;
+    else if (strcmp(cs, "mono") == 0)
+        m_chromaBytes = 0;
+    else
+        throw CError("CLumaStream(%s): unsupported colorspace", filename);
+}
+
+void CLumaStream::Open(const char* filename, int width, int height)
+{
+    if (filename == NULL)
+        throw CError("CLumaStream: empty filename");
+    Close();
+
+    const char *dot = strrchr(filename, '.');
+    bool isStdin = strcmp(filename, "-") == 0;
+    m_isY4M = isStdin ? (width == 0) : (dot != NULL && strcmp(dot, ".y4m") == 0);
+    m_width = width;
+    m_height = height;
+    m_chromaBytes = 0;
+    if (! m_isY4M)
+    {
+        if (width < 1 || height < 1)
+            throw CError("CLumaStream(%s): raw video needs a frame size", filename);
+        if (! isStdin && dot != NULL && strcmp(dot, ".yuv") == 0)
+            m_chromaBytes = 2 * (size_t) ((width + 1) / 2) * ((height + 1) / 2);
+    }
+
+    // Map regular files, read everything else through stdio
+    struct stat st;
+    int fd = isStdin ? -1 : open(filename, O_RDONLY);
+    if (! isStdin && fd < 0)
+        throw CError("CLumaStream: could not open %s", filename);
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        m_mapBytes = st.st_size;
+        void *ptr = mmap(0, m_mapBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+            throw CError("CLumaStream: could not map %s", filename);
+        madvise(ptr, m_mapBytes, MADV_SEQUENTIAL);
+        m_mapping = new CLumaMapping;
+        m_mapping->base = ptr;
+        m_mapping->nBytes = m_mapBytes;
+        m_mapping->refCnt = 1;
+        m_map = (uchar *) ptr;
+    }
+    else
+        m_stream = isStdin ? stdin : fdopen(fd, "rb");
+    if (m_map == 0 && m_stream == 0)
+        throw CError("CLumaStream: could not open %s", filename);
+
+    // Stream header
+    if (m_isY4M)
+    {
+        char line[256];
+        int n = 0, c;
+        if (m_map)
+        {
+            while (m_pos < m_mapBytes && m_map[m_pos] != '\n' && n < 255)
+                line[n++] = m_map[m_pos++];
+            c = (m_pos < m_mapBytes) ? m_map[m_pos] : EOF;
+            m_pos++;
+        }
+        else
+            while ((c = getc(m_stream)) != EOF && c != '\n' && n < 255)
+                line[n++] = (char) c;
+        line[n] = 0;
+        if (n == 255 && c != '\n')
+            throw CError("CLumaStream(%s): header line longer than 255 characters", filename);
+        ParseY4MHeader(line, filename);
+    }
+}
+
+bool CLumaStream::ReadFrame(CByteImage& img)
+{
+    CShape sh(m_width, m_height, 1);
+    size_t yBytes = (size_t) m_width * m_height;
+
+    if (m_map)
+    {
+        // Skip the FRAME header (and its parameters), then hand out a view
+        if (m_pos >= m_mapBytes)
+            return false;
+        if (m_isY4M)
+        {
+            if (m_mapBytes - m_pos < 5 || memcmp(m_map + m_pos, "FRAME", 5) != 0)
+                throw CError("CLumaStream: FRAME header expected at byte %d", (int) m_pos);
+            while (m_pos < m_mapBytes && m_map[m_pos] != '\n')
+                m_pos++;
+            m_pos++;
+        }
+        if (m_pos + yBytes + m_chromaBytes > m_mapBytes)
+            throw CError("CLumaStream: truncated frame at byte %d", (int) m_pos);
+        m_mapping->refCnt.fetch_add(1, std::memory_order_relaxed);
+        img.ReAllocate(sh, m_map + m_pos, true, m_width, ReleaseLumaMapping, m_mapping);
+        m_pos += yBytes + m_chromaBytes;
+        return true;
+    }
+
+    if (m_stream == 0)
+        throw CError("CLumaStream: stream is not open");
+    if (m_isY4M)
+    {
+        char tag[5];
+        if (fread(tag, 1, 5, m_stream) != 5)
+            return false;
+        if (memcmp(tag, "FRAME", 5) != 0)
+            throw CError("CLumaStream: FRAME header expected");
+        int c;
+        while ((c = getc(m_stream)) != EOF && c != '\n')
+            ;
+    }
+
+    // Read the Y plane into a new image and drop the chroma planes
+    CByteImage frame(sh);
+    for (int y = 0; y < m_height; y++)
+    {
+        size_t n = fread(&frame.Pixel(0, y, 0), 1, m_width, m_stream);
+        if (n == 0 && y == 0 && ! m_isY4M)
+            return false;
+        if (n != (size_t) m_width)
+            throw CError("CLumaStream: truncated frame in row %d", y);
+    }
+    char skip[4096];
+    for (size_t left = m_chromaBytes; left > 0; )
+    {
+        size_t n = fread(skip, 1, left < sizeof(skip) ? left : sizeof(skip), m_stream);
+        if (n == 0)
+            throw CError("CLumaStream: truncated chroma planes");
+        left -= n;
+    }
+    img = frame;
+    return true;
+}
+
 void ReadImage (CImage& img, const char* filename)
 {
 	if (filename == NULL)
@@ -21,6 +21,7 @@
 //  - PMF (multiband float) - homegrown, non-standard
 //        (PFM already taken by postscript font maps)
 //  - PNG (requires ImageIOpng.cpp, and pnglib and zlib packages)
+//  - YUV4MPEG2 and raw planar video, luma only (CLumaStream)
 //
 // SEE ALSO
 //  ImageIO.cpp          implementation
@@ -36,3 +37,49 @@ void WriteImage(CImage& img, const char* filename);
 
 void ReadImageVerb (CImage& img, const char* filename, int verbose);
 void WriteImageVerb(CImage& img, const char* filename, int verbose);
+
+// Read straight into a 1-band gray image.  PGM and PPM files are mapped
+// and decoded in one pass (PPM converted to luma with the ConvertToGray
+// formula, without an RGBA intermediate); other formats go through
+// ReadImage and ConvertToGray.
+void ReadImageGray(CByteImage& img, const char* filename);
+
+// Streaming luma reader for continuous video: YUV4MPEG2 (.y4m, 8-bit),
+// raw planar 4:2:0 (.yuv) and raw luma-only files (any other extension,
+// width and height required).  "-" reads stdin: Y4M when no size is
+// given, raw luma otherwise.
+//
+// ReadFrame hands out the Y plane of the next frame as a 1-band image
+// and returns false at the end of the stream.  Regular files are mapped
+// and each frame is a zero-copy view of the mapping (copy-on-write) that
+// keeps the mapping alive, also past Close(); pipes are read into a newly
+// allocated image per frame, so earlier frames stay valid either way.
+
+struct CLumaMapping;
+
+class CLumaStream
+{
+public:
+    CLumaStream(void);
+    ~CLumaStream(void);
+    void Open(const char* filename, int width = 0, int height = 0);
+    bool ReadFrame(CByteImage& img);    // next Y plane, false at the end
+    void Close(void);
+
+    int Width(void)     { return m_width; }
+    int Height(void)    { return m_height; }
+
+private:
+    CLumaStream(const CLumaStream&);            // not copyable
+    CLumaStream& operator=(const CLumaStream&);
+    void ParseY4MHeader(const char* line, const char* filename);
+
+    FILE* m_stream;         // pipe or stdin (when not mapped)
+    CLumaMapping* m_mapping;    // shared with the frames handed out
+    uchar* m_map;           // mapped file data (when not a pipe)
+    size_t m_mapBytes;      // size of the mapping
+    size_t m_pos;           // read position in the mapping
+    bool m_isY4M;           // frames are preceded by FRAME headers
+    int m_width, m_height;  // frame size
+    size_t m_chromaBytes;   // bytes following each Y plane
+};
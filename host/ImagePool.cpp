@@ -0,0 +1,204 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// NAME
+//  ImagePool.cpp -- aligned, recycling allocator for image memory
+//
+// DESCRIPTION
+//  Each block is preceded by one alignment unit holding a small header
+//  (the usable size and the address returned by posix_memalign), so
+//  ImagePoolRelease() only needs the block pointer.  Free blocks are
+//  kept in a map from usable size to a stack of blocks, so the most
+//  recently released (cache-warm) block of a size is reused first.
+//
+// SEE ALSO
+//  ImagePool.h         definition and explanation of the pool
+//
+///////////////////////////////////////////////////////////////////////////
+
+#include "ImagePool.h"
+#include <stdlib.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE  (2 << 20)
+
+struct pool_header_t        // lives in the alignment unit before each block
+{
+    size_t nBytes;          // usable size of the block
+    void *raw;              // address to hand back to free()
+};
+
+struct pool_state_t
+{
+    std::mutex lock;
+    std::map<size_t, std::vector<void *> > freeLists;   // usable size -> blocks
+    size_t cachedBytes;     // memory held on the free lists
+    size_t maxCachedBytes;  // cap on cachedBytes
+    bool hugePages;         // advise huge pages for big blocks
+    bool padPitch;          // pad pitches away from the alias stride
+    int allocs;             // calls to ImagePoolAllocate
+    int reuses;             // ... served from the free lists
+};
+
+static pool_state_t *NewPool()
+{
+    pool_state_t *pool = new pool_state_t;
+    pool->cachedBytes = 0;
+    pool->maxCachedBytes = 256 << 20;
+    pool->hugePages = false;
+    pool->padPitch = true;
+    pool->allocs = 0;
+    pool->reuses = 0;
+    return pool;
+}
+
+static pool_state_t& Pool()
+{
+    // Never destroyed, so images in static objects can still be
+    // released during program exit
+    static pool_state_t *pool = NewPool();
+    return *pool;
+}
+
+static pool_header_t *Header(void *ptr)
+{
+    return (pool_header_t *) ((char *) ptr - IMAGE_POOL_ALIGN);
+}
+
+static void *NewBlock(size_t nBytes, bool hugePages)
+{
+    // Fresh aligned block from the system
+    size_t total = nBytes + IMAGE_POOL_ALIGN;
+    size_t align = IMAGE_POOL_ALIGN;
+    bool huge = hugePages && total >= HUGE_PAGE_SIZE;
+    if (huge)
+    {
+        align = HUGE_PAGE_SIZE;
+        total = (total + HUGE_PAGE_SIZE - 1) & ~(size_t) (HUGE_PAGE_SIZE - 1);
+    }
+    void *raw = 0;
+    if (posix_memalign(&raw, align, total) != 0)
+        return 0;
+#ifdef MADV_HUGEPAGE
+    if (huge)
+        madvise(raw, total, MADV_HUGEPAGE);     // only a hint, failure is harmless
+#endif
+    void *ptr = (char *) raw + IMAGE_POOL_ALIGN;
+    Header(ptr)->nBytes = nBytes;
+    Header(ptr)->raw = raw;
+    return ptr;
+}
+
+void *ImagePoolAllocate(size_t nBytes)
+{
+    // Aligned block of at least nBytes, recycled if possible
+    nBytes = (nBytes + IMAGE_POOL_ALIGN - 1) & ~(size_t) (IMAGE_POOL_ALIGN - 1);
+    pool_state_t& pool = Pool();
+    bool hugePages;
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.allocs += 1;
+        std::map<size_t, std::vector<void *> >::iterator it = pool.freeLists.find(nBytes);
+        if (it != pool.freeLists.end() && ! it->second.empty())
+        {
+            void *ptr = it->second.back();
+            it->second.pop_back();
+            pool.cachedBytes -= nBytes;
+            pool.reuses += 1;
+            return ptr;
+        }
+        hugePages = pool.hugePages;
+    }
+    return NewBlock(nBytes, hugePages);
+}
+
+void ImagePoolRelease(void *ptr)
+{
+    // Return a block to the free list, or to the system if the pool is full
+    if (ptr == 0)
+        return;
+    pool_header_t *header = Header(ptr);
+    pool_state_t& pool = Pool();
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        if (pool.cachedBytes + header->nBytes <= pool.maxCachedBytes)
+        {
+            pool.freeLists[header->nBytes].push_back(ptr);
+            pool.cachedBytes += header->nBytes;
+            return;
+        }
+    }
+    free(header->raw);
+}
+
+int ImagePoolRowPitch(int rowBytes, int height)
+{
+    // Round up to the alignment, then step off the alias stride
+    // (a single row cannot alias with anything)
+    int pitch = (rowBytes + IMAGE_POOL_ALIGN - 1) & -IMAGE_POOL_ALIGN;
+    bool padPitch;
+    {
+        pool_state_t& pool = Pool();
+        std::lock_guard<std::mutex> guard(pool.lock);
+        padPitch = pool.padPitch;
+    }
+    if (padPitch && height > 1 && pitch > 0 &&
+        pitch % IMAGE_POOL_ALIAS_STRIDE == 0)
+        pitch += IMAGE_POOL_ALIGN;
+    return pitch;
+}
+
+void ImagePoolSetLimit(size_t maxCachedBytes)
+{
+    pool_state_t& pool = Pool();
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.maxCachedBytes = maxCachedBytes;
+        if (pool.cachedBytes <= maxCachedBytes)
+            return;
+    }
+    ImagePoolTrim();
+}
+
+void ImagePoolSetHugePages(bool enable)
+{
+    pool_state_t& pool = Pool();
+    std::lock_guard<std::mutex> guard(pool.lock);
+    pool.hugePages = enable;
+}
+
+void ImagePoolSetPitchPadding(bool enable)
+{
+    pool_state_t& pool = Pool();
+    std::lock_guard<std::mutex> guard(pool.lock);
+    pool.padPitch = enable;
+}
+
+void ImagePoolTrim()
+{
+    // Return all cached blocks to the system
+    std::map<size_t, std::vector<void *> > freeLists;
+    pool_state_t& pool = Pool();
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        freeLists.swap(pool.freeLists);
+        pool.cachedBytes = 0;
+    }
+    std::map<size_t, std::vector<void *> >::iterator it;
+    for (it = freeLists.begin(); it != freeLists.end(); it++)
+        for (size_t i = 0; i < it->second.size(); i++)
+            free(Header(it->second[i])->raw);
+}
+
+void ImagePoolStats(int& allocs, int& reuses, size_t& cachedBytes)
+{
+    pool_state_t& pool = Pool();
+    std::lock_guard<std::mutex> guard(pool.lock);
+    allocs = pool.allocs;
+    reuses = pool.reuses;
+    cachedBytes = pool.cachedBytes;
+}
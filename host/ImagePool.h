@@ -0,0 +1,68 @@
+///////////////////////////////////////////////////////////////////////////
+//
+// NAME
+//  ImagePool.h -- aligned, recycling allocator for image memory
+//
+// DESCRIPTION
+//  CImage::ReAllocate() gets its pixel memory from this pool instead of
+//  the plain heap.  Every block is aligned to IMAGE_POOL_ALIGN bytes, so
+//  the first pixel of every row is aligned for SIMD loads (the row pitch
+//  is rounded up to the same boundary, see ImagePoolRowPitch()).
+//
+//  Released blocks are kept on a free list keyed by their size and
+//  handed out again to the next allocation of the same size, i.e., to
+//  the next image of the same shape and pixel type.  This makes the
+//  per-frame allocation of temporary images in the host loop essentially
+//  free.  The amount of memory held on the free lists is capped (see
+//  ImagePoolSetLimit()); blocks beyond the cap are returned to the system.
+//
+//  Large blocks can optionally be backed by transparent huge pages
+//  (Linux only), which cuts TLB misses on frame-sized buffers.
+//
+//  Row pitches that are a multiple of IMAGE_POOL_ALIAS_STRIDE (4 KB)
+//  make the rows of an image map onto the same cache sets, which hurts
+//  every vertical filter.  By default such pitches are padded by one
+//  alignment unit.
+//
+// SEE ALSO
+//  ImagePool.cpp       implementation
+//  Image.h             image class allocating from the pool
+//
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef __IMAGE_POOL_H__
+#define __IMAGE_POOL_H__
+
+#include <stddef.h>
+
+#define IMAGE_POOL_ALIGN        64      // alignment of blocks and row pitches
+#define IMAGE_POOL_ALIAS_STRIDE 4096    // pitches that are multiples of this get padded
+
+void *ImagePoolAllocate(size_t nBytes);
+    // aligned block of at least nBytes, recycled if possible
+
+void ImagePoolRelease(void *ptr);
+    // return a block obtained from ImagePoolAllocate (usable as a
+    // CRefCntMem delete function)
+
+int ImagePoolRowPitch(int rowBytes, int height);
+    // row pitch in bytes for rows of rowBytes, rounded up to
+    // IMAGE_POOL_ALIGN and padded away from IMAGE_POOL_ALIAS_STRIDE
+
+void ImagePoolSetLimit(size_t maxCachedBytes);
+    // cap on the memory kept on the free lists (0 disables recycling)
+
+void ImagePoolSetHugePages(bool enable);
+    // back blocks of 2 MB and more with transparent huge pages
+
+void ImagePoolSetPitchPadding(bool enable);
+    // pad row pitches that are multiples of IMAGE_POOL_ALIAS_STRIDE
+
+void ImagePoolTrim(void);
+    // return all cached blocks to the system
+
+void ImagePoolStats(int& allocs, int& reuses, size_t& cachedBytes);
+    // allocation count, how many were served from the free lists,
+    // and the memory currently held on them
+
+#endif // __IMAGE_POOL_H__
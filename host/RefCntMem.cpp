@@ -29,15 +29,16 @@ CRefCntMem::~CRefCntMem()
 void CRefCntMem::DecrementCount()
 {
     // Decrement the reference count and delete if done
+    // (acq_rel: whoever frees the memory must see all writes made
+    //  through the other references before they were dropped)
     if (m_ptr)
     {
-        m_ptr->m_refCnt -= 1;
-        if (m_ptr->m_refCnt == 0)
+        if (m_ptr->m_refCnt.fetch_sub(1, std::memory_order_acq_rel) == 1)
         {
             if (m_ptr->m_deleteWhenDone)
             {
                 if (m_ptr->m_delFn)
-                    m_ptr->m_delFn(m_ptr->m_memory);
+                    m_ptr->m_delFn(m_ptr->m_delArg ? m_ptr->m_delArg : m_ptr->m_memory);
                 else
                     delete (double *) m_ptr->m_memory;
             }
@@ -49,9 +50,10 @@ void CRefCntMem::DecrementCount()
 void CRefCntMem::IncrementCount()
 {
     // Increment the reference count
+    // (relaxed: a new reference can only be made from an existing one)
     if (m_ptr)
     {
-        m_ptr->m_refCnt += 1;
+        m_ptr->m_refCnt.fetch_add(1, std::memory_order_relaxed);
     }
 }
 
@@ -62,17 +64,39 @@ CRefCntMem::CRefCntMem(const CRefCntMem& ref)
     (*this) = ref;      // use assignment operator
 }
 
+CRefCntMem::CRefCntMem(CRefCntMem&& ref)
+{
+    // Move constructor: take over the reference, count unchanged
+    m_ptr = ref.m_ptr;
+    ref.m_ptr = 0;
+}
+
 CRefCntMem& CRefCntMem::operator=(const CRefCntMem& ref)
 {
     // Assignment
+    if (m_ptr == ref.m_ptr)
+        return *this;   // also covers self-assignment
     DecrementCount();   // if m_ptr exists, no longer pointing to it
     m_ptr = ref.m_ptr;
     IncrementCount();
     return *this;
 }
 
+CRefCntMem& CRefCntMem::operator=(CRefCntMem&& ref)
+{
+    // Move assignment: drop our reference, take over theirs
+    if (this != &ref)
+    {
+        DecrementCount();
+        m_ptr = ref.m_ptr;
+        ref.m_ptr = 0;
+    }
+    return *this;
+}
+
 void CRefCntMem::ReAllocate(int nBytes, void *memory, bool deleteWhenDone,
-                            void (*deleteFunction)(void *ptr))
+                            void (*deleteFunction)(void *ptr),
+                            void *deleteArg)
 {
     // Allocate/deallocate memory
     DecrementCount();
@@ -84,6 +108,7 @@ void CRefCntMem::ReAllocate(int nBytes, void *memory, bool deleteWhenDone,
         m_ptr->m_deleteWhenDone = deleteWhenDone;
         m_ptr->m_refCnt = 1;
         m_ptr->m_delFn = deleteFunction;
+        m_ptr->m_delArg = deleteArg;
     }
     else
         m_ptr = 0;  // don't bother storing pointer to null memory
@@ -13,6 +13,11 @@
 //  the including class to achieve a similar kind of memory sharing as
 //  is found in garbage collected languages such as Java and C#.
 //
+//  The reference count is atomic, so copies of the same memory may be
+//  created and destroyed concurrently from different threads (the
+//  memory itself is not protected).  Moving an object transfers the
+//  reference without touching the count at all.
+//
 // SEE ALSO
 //  RefCntMem.cpp       implementation
 //  Image.h             class that uses a CRefCntMem object
@@ -22,13 +27,16 @@
 //
 ///////////////////////////////////////////////////////////////////////////
 
+#include <atomic>
+
 struct CRefCntMemPtr         // shared component of reference counted memory
 {
     void *m_memory;         // allocated memory
-    int m_refCnt;           // reference count
+    std::atomic<int> m_refCnt;  // reference count
     int m_nBytes;           // number of bytes
     bool m_deleteWhenDone;  // delete memory when ref-count drops to 0
     void (*m_delFn)(void *ptr); // optional delete function
+    void *m_delArg;         // what m_delFn gets, m_memory if 0
 };
 
 class CRefCntMem            // reference-counted memory allocator
@@ -36,12 +44,16 @@ class CRefCntMem            // reference-counted memory allocator
 public:
     CRefCntMem(void);           // default constructor
     CRefCntMem(const CRefCntMem& ref);  // copy constructor
+    CRefCntMem(CRefCntMem&& ref);       // move constructor
     ~CRefCntMem(void);          // destructor
     CRefCntMem& operator=(const CRefCntMem& ref);  // assignment
+    CRefCntMem& operator=(CRefCntMem&& ref);       // move assignment
 
     void ReAllocate(int nBytes, void *memory, bool deleteWhenDone,
-                    void (*deleteFunction)(void *ptr) = 0);
-        // allocate/deallocate memory
+                    void (*deleteFunction)(void *ptr) = 0,
+                    void *deleteArg = 0);
+        // allocate/deallocate memory (deleteFunction is called with
+        // deleteArg if given, e.g. a block describing a mapping)
     int NBytes(void);           // number of stored bytes
     bool InBounds(int i);       // check if index is in bounds
     void* Memory(void);         // pointer to allocated memory
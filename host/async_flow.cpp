@@ -0,0 +1,116 @@
+/*===============================================================*/
+/*                                                               */
+/*                        async_flow.cpp                         */
+/*                                                               */
+/*    Asynchronous optical flow with frame sets in flight        */
+/*                                                               */
+/*===============================================================*/
+
+#include "async_flow.h"
+#include "pack_frames.h"
+#include "flow_engine.h"
+
+CAsyncFlowEngine::CAsyncFlowEngine(int width, int height, int nframes, int inFlight)
+  : m_width(width), m_height(height), m_nframes(nframes),
+    m_free(inFlight), m_pack(inFlight), m_compute(inFlight), m_finish(inFlight)
+{
+  if (width < 1 || width > MAX_WIDTH || height < 1 || height > MAX_HEIGHT)
+    throw CError("CAsyncFlowEngine: illegal frame size");
+  if (nframes != TEMPORAL_5_FRAME && nframes != TEMPORAL_3_FRAME && nframes != TEMPORAL_2_FRAME)
+    throw CError("CAsyncFlowEngine: %d frames is not a temporal mode", nframes);
+  if (inFlight < 1)
+    throw CError("CAsyncFlowEngine: %d frame sets in flight", inFlight);
+
+  for (int i = 0; i < inFlight; i++)
+  {
+    m_slots.push_back(new Slot);
+    m_free.Push(m_slots[i]);
+  }
+  m_packer = std::thread(&CAsyncFlowEngine::Pack, this);
+  m_computer = std::thread(&CAsyncFlowEngine::Compute, this);
+  m_finisher = std::thread(&CAsyncFlowEngine::Finish, this);
+}
+
+CAsyncFlowEngine::~CAsyncFlowEngine()
+{
+  // wake a Submit waiting for a slot (it throws), then let each stage
+  // close the next one once it has drained its queue
+  m_free.Close();
+  m_pack.Close();
+  m_packer.join();
+  m_computer.join();
+  m_finisher.join();
+  for (size_t i = 0; i < m_slots.size(); i++)
+    delete m_slots[i];
+}
+
+std::future<CFloatImage> CAsyncFlowEngine::Submit(CByteImage frames[], Callback done)
+{
+  for (int i = 0; i < m_nframes; i++)
+  {
+    CShape sh = frames[i].Shape();
+    if (sh.width != m_width || sh.height != m_height || sh.nBands != 1)
+      throw CError("CAsyncFlowEngine: frame %d does not match the engine size", i);
+  }
+
+  Slot *slot;
+  if (!m_free.Pop(slot))
+    throw CError("CAsyncFlowEngine: engine is shutting down");
+  for (int i = 0; i < m_nframes; i++)
+    slot->imgs[i] = frames[i];
+  slot->result = std::promise<CFloatImage>();
+  slot->done = done;
+  std::future<CFloatImage> future = slot->result.get_future();
+  if (!m_pack.Push(slot))
+    throw CError("CAsyncFlowEngine: engine is shutting down");
+  return future;
+}
+
+void CAsyncFlowEngine::Pack()
+{
+  Slot *slot;
+  while (m_pack.Pop(slot))
+  {
+    pack_frames(slot->imgs, slot->frames, m_nframes);
+    m_compute.Push(slot);
+  }
+  m_compute.Close();
+}
+
+void CAsyncFlowEngine::Compute()
+{
+  Slot *slot;
+  while (m_compute.Pop(slot))
+  {
+    optical_flow(slot->frames, slot->outputs, m_streams, m_height, m_width, 1, m_nframes);
+    m_finish.Push(slot);
+  }
+  m_finish.Close();
+}
+
+void CAsyncFlowEngine::Finish()
+{
+  Slot *slot;
+  while (m_finish.Pop(slot))
+  {
+    CFloatImage flow;
+    COpticalFlowEngine::CopyFlow(slot->outputs, m_width, m_height, flow);
+
+    try
+    {
+      if (slot->done)
+        slot->done(flow);
+      slot->result.set_value(flow);
+    }
+    catch (...)
+    {
+      slot->result.set_exception(std::current_exception());
+    }
+
+    // drop the frames before the slot is reused
+    for (int i = 0; i < 5; i++)
+      slot->imgs[i] = CByteImage();
+    slot->done = Callback();
+    m_free.Push(slot);
+  }
+}
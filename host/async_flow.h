@@ -0,0 +1,70 @@
+/*===============================================================*/
+/*                                                               */
+/*                         async_flow.h                          */
+/*                                                               */
+/*    Asynchronous optical flow with frame sets in flight        */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __ASYNC_FLOW_H__
+#define __ASYNC_FLOW_H__
+
+#include <vector>
+#include <thread>
+#include <future>
+#include <functional>
+#include "typedefs.h"
+#include "imageLib.h"
+#include "bounded_queue.h"
+#include "../sdsoc/optical_flow.h"
+
+// Submit hands a frame set to the optical_flow() chain and returns at
+// once with a future for its 2-band flow image.  Packing, compute and
+// converting the result run on their own threads over a ring of
+// `inFlight` frame set buffers, so consecutive submissions overlap the
+// way the batch driver's stages do.  When all buffers are taken, Submit
+// blocks until the oldest frame set completes (back-pressure).
+//
+// Results complete in submission order.  The optional callback runs on
+// the result thread just before the future becomes ready; an exception
+// it throws is passed on through the future.  The destructor finishes
+// all submitted work; a Submit still waiting for a buffer then throws.
+class CAsyncFlowEngine
+{
+public:
+  typedef std::function<void(CFloatImage& flow)> Callback;
+
+  CAsyncFlowEngine(int width = MAX_WIDTH, int height = MAX_HEIGHT,
+                   int nframes = TEMPORAL_5_FRAME, int inFlight = 4);
+  ~CAsyncFlowEngine(void);
+
+  // queue nframes gray frames of the engine's size (oldest first); the
+  // images are shared, not copied, and must not change until completion
+  std::future<CFloatImage> Submit(CByteImage frames[], Callback done = Callback());
+
+private:
+  CAsyncFlowEngine(const CAsyncFlowEngine&) = delete;
+  CAsyncFlowEngine& operator=(const CAsyncFlowEngine&) = delete;
+
+  struct Slot
+  {
+    CByteImage imgs[5];
+    hls::stream<frames_t> frames;
+    velocity_t outputs[MAX_HEIGHT][MAX_WIDTH];
+    std::promise<CFloatImage> result;
+    Callback done;
+  };
+
+  void Pack(void);
+  void Compute(void);
+  void Finish(void);
+
+  int m_width, m_height, m_nframes;
+  std::vector<Slot *> m_slots;
+  flow_streams_t m_streams;    // between the operators, used by Compute
+  // the slots circulate free -> pack -> compute -> finish -> free
+  CBoundedQueue<Slot *> m_free, m_pack, m_compute, m_finish;
+  std::thread m_packer, m_computer, m_finisher;
+};
+
+#endif
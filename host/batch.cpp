@@ -0,0 +1,179 @@
+/*===============================================================*/
+/*                                                               */
+/*                          batch.cpp                            */
+/*                                                               */
+/*      Pipelined batch driver over a list of frame sets         */
+/*                                                               */
+/*===============================================================*/
+
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <sys/time.h>
+
+#include "typedefs.h"
+#include "batch.h"
+#include "bounded_queue.h"
+#include "check_result.h"
+#include "frame_cache.h"
+#include "pack_frames.h"
+#include "../sdsoc/optical_flow.h"
+
+// frame set buffers in flight: one per pipeline stage
+const int BATCH_SLOTS = 4;
+
+typedef struct
+{
+  std::string dataPath;
+  std::string outFile;
+  CByteImage imgs[5];
+  CFloatImage refFlow;
+  hls::stream<frames_t> frames;
+  velocity_t outputs[MAX_HEIGHT][MAX_WIDTH];
+  long long compute_us;
+}batch_slot_t;
+
+static long long now_us()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// read the frame set list: "<data path> [output file]" per line
+static void read_batch_list(const std::string& listFile,
+                            std::vector<std::string>& dataPaths,
+                            std::vector<std::string>& outFiles)
+{
+  std::ifstream list(listFile.c_str());
+  if (!list)
+    throw CError("run_batch: could not open %s", listFile.c_str());
+
+  std::string line;
+  while (std::getline(list, line))
+  {
+    std::istringstream fields(line);
+    std::string dataPath, outFile;
+    if (!(fields >> dataPath) || dataPath[0] == '#')
+      continue;
+    if (!(fields >> outFile))
+      outFile = dataPath + "/out.flo";
+    dataPaths.push_back(dataPath);
+    outFiles.push_back(outFile);
+  }
+}
+
+void run_batch(const std::string& listFile)
+{
+  std::vector<std::string> dataPaths, outFiles;
+  read_batch_list(listFile, dataPaths, outFiles);
+  printf("Batch of %d frame sets\n", (int) dataPaths.size());
+
+  // the slots circulate free -> load -> pack -> compute -> check -> free;
+  // a slot is only ever touched by the stage that popped it, and only
+  // the load stage copies the cached images it holds
+  std::vector<batch_slot_t *> slots;
+  CBoundedQueue<batch_slot_t *> free_q(BATCH_SLOTS), pack_q(BATCH_SLOTS),
+                                compute_q(BATCH_SLOTS), check_q(BATCH_SLOTS);
+  for (int i = 0; i < BATCH_SLOTS; i++)
+  {
+    slots.push_back(new batch_slot_t);
+    free_q.Push(slots[i]);
+  }
+
+  // only the load stage touches the cache
+  CFrameCache frame_cache(2 * BATCH_SLOTS + 5);
+  long long start = now_us();
+
+  std::thread loader([&] {
+    for (size_t n = 0; n < dataPaths.size(); n++)
+    {
+      batch_slot_t *slot;
+      if (!free_q.Pop(slot))
+        break;
+      slot->dataPath = dataPaths[n];
+      slot->outFile = outFiles[n];
+      try
+      {
+        for (int i = 0; i < 5; i++)
+        {
+          std::ostringstream name;
+          name << dataPaths[n] << "/frame" << i + 1 << ".ppm";
+          slot->imgs[i] = frame_cache.Get(name.str());
+          CShape sh = slot->imgs[i].Shape();
+          if (sh.width != MAX_WIDTH || sh.height != MAX_HEIGHT)
+            throw CError("run_batch: %s has the wrong frame size", name.str().c_str());
+        }
+        ReadFlowFileMapped(slot->refFlow, (dataPaths[n] + "/ref.flo").c_str());
+      }
+      catch (CError &err)
+      {
+        // skip this frame set, keep the pipeline going
+        fprintf(stderr, "%s\n", err.message);
+        free_q.Push(slot);
+        continue;
+      }
+      pack_q.Push(slot);
+    }
+    pack_q.Close();
+  });
+
+  std::thread packer([&] {
+    batch_slot_t *slot;
+    while (pack_q.Pop(slot))
+    {
+      pack_frames(slot->imgs, slot->frames);
+      compute_q.Push(slot);
+    }
+    compute_q.Close();
+  });
+
+  std::thread computer([&] {
+    batch_slot_t *slot;
+    while (compute_q.Pop(slot))
+    {
+      long long t0 = now_us();
+      optical_flow(slot->frames, slot->outputs);
+      slot->compute_us = now_us() - t0;
+      check_q.Push(slot);
+    }
+    check_q.Close();
+  });
+
+  long long compute_total = 0;
+  std::thread checker([&] {
+    batch_slot_t *slot;
+    while (check_q.Pop(slot))
+    {
+      printf("%s: ", slot->dataPath.c_str());
+      try
+      {
+        check_results(slot->outputs, slot->refFlow, slot->outFile);
+      }
+      catch (CError &err)
+      {
+        // report this frame set, keep the pipeline going
+        printf("failed\n");
+        fprintf(stderr, "%s\n", err.message);
+      }
+      compute_total += slot->compute_us;
+      free_q.Push(slot);
+    }
+    free_q.Close();
+  });
+
+  loader.join();
+  packer.join();
+  computer.join();
+  checker.join();
+
+  long long elapsed = now_us() - start;
+  printf("Frame cache: %d hits, %d misses\n", frame_cache.Hits(), frame_cache.Misses());
+  printf("batch time: %lld us, compute time: %lld us\n", elapsed, compute_total);
+
+  for (int i = 0; i < BATCH_SLOTS; i++)
+    delete slots[i];
+}
@@ -0,0 +1,24 @@
+/*===============================================================*/
+/*                                                               */
+/*                           batch.h                             */
+/*                                                               */
+/*      Pipelined batch driver over a list of frame sets         */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <string>
+
+// Run every frame set listed in listFile, one per line:
+//
+//   <data path> [output .flo file]
+//
+// The data path holds frame1.ppm .. frame5.ppm and ref.flo; the output
+// defaults to <data path>/out.flo.  Load, pack, compute and check/write
+// run on separate threads over a small ring of frame set buffers, so
+// set N+1 loads while set N computes and set N-1 is evaluated.
+void run_batch(const std::string& listFile);
+
+#endif
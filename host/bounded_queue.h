@@ -0,0 +1,64 @@
+/*===============================================================*/
+/*                                                               */
+/*                       bounded_queue.h                         */
+/*                                                               */
+/*     Blocking bounded queue for handing work between threads   */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __BOUNDED_QUEUE_H__
+#define __BOUNDED_QUEUE_H__
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// Push blocks while the queue is full (back-pressure), Pop blocks while
+// it is empty.  After Close, Push fails and Pop drains what is left and
+// then returns false, so each pipeline stage can shut down the next one.
+template <class T>
+class CBoundedQueue
+{
+public:
+  CBoundedQueue(int capacity) : m_capacity(capacity), m_closed(false) {}
+
+  bool Push(T item)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notFull.wait(lock, [this] { return m_closed || (int) m_items.size() < m_capacity; });
+    if (m_closed)
+      return false;
+    m_items.push_back(std::move(item));
+    m_notEmpty.notify_one();
+    return true;
+  }
+
+  bool Pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notEmpty.wait(lock, [this] { return m_closed || ! m_items.empty(); });
+    if (m_items.empty())
+      return false;
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  void Close(void)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+  }
+
+private:
+  std::deque<T> m_items;
+  std::mutex m_mutex;
+  std::condition_variable m_notEmpty, m_notFull;
+  int m_capacity;
+  bool m_closed;
+};
+
+#endif
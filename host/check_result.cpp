@@ -9,20 +9,98 @@
 #include <cstdio>
 #include <string>
 #include <cmath>
+#include <vector>
 
 #include "typedefs.h"
 #include "imageLib.h"
 
+// angular error in degrees of one vector, normalized to [0, 180]
+static inline double angle_error(double out_x, double out_y, double ref_x, double ref_y)
+{
+  double out_deg = atan2(-out_y, -out_x) * 180.0 / M_PI;
+  double ref_deg = atan2(-ref_y, -ref_x) * 180.0 / M_PI;
+
+  // Normalize error to [-180, 180]
+  double error = out_deg - ref_deg;
+  while (error < -180) error += 360;
+  while (error > 180) error -= 360;
+  return fabs(error);
+}
+
+// average angular error of outFlow against refFlow, skipping unknown flow
+static void print_error(CFloatImage& outFlow, CFloatImage& refFlow)
+{
+  double accum_error = 0;
+  int num_pix = 0;
+  for (int i = 0; i < MAX_HEIGHT; i++) 
+  {
+    const float *out = outFlow.Row(i).Data();
+    const float *ref = refFlow.Row(i).Data();
+    for (int j = 0; j < MAX_WIDTH; j++) 
+    {
+      double out_x = out[2*j];
+      double out_y = out[2*j + 1];
+
+      if (unknown_flow(out_x, out_y)) continue;
+
+      accum_error += angle_error(out_x, out_y, ref[2*j], ref[2*j + 1]);
+      num_pix++;
+    }
+  }
+
+  double avg_error = accum_error / num_pix;
+  printf("Average error: %lf degrees\n", avg_error);
+
+}
+
+// the same for flow given as x and y planes with rows pitch floats apart
+static void print_error(const float *flow_x, const float *flow_y, int pitch, CFloatImage& refFlow)
+{
+  double accum_error = 0;
+  int num_pix = 0;
+  for (int i = 0; i < MAX_HEIGHT; i++) 
+  {
+    const float *out_x = flow_x + i * pitch;
+    const float *out_y = flow_y + i * pitch;
+    const float *ref = refFlow.Row(i).Data();
+    for (int j = 0; j < MAX_WIDTH; j++) 
+    {
+      if (unknown_flow(out_x[j], out_y[j])) continue;
+
+      accum_error += angle_error(out_x[j], out_y[j], ref[2*j], ref[2*j + 1]);
+      num_pix++;
+    }
+  }
+
+  double avg_error = accum_error / num_pix;
+  printf("Average error: %lf degrees\n", avg_error);
+
+}
+
+// the output flow image: mapped straight onto a .flo file, otherwise
+// in memory, to be written with WriteFlowFile once filled (false)
+static bool create_output(CFloatImage& outFlow, const std::string& outFile)
+{
+  bool mapped = outFile.size() > 4 && outFile.compare(outFile.size() - 4, 4, ".flo") == 0;
+  if (mapped)
+    CreateFlowFileMapped(outFlow, outFile.c_str(), MAX_WIDTH, MAX_HEIGHT);
+  else
+    outFlow.ReAllocate(CShape(MAX_WIDTH, MAX_HEIGHT, 2));
+  return mapped;
+}
+
 #ifdef OCL
 void check_results(velocity_t output[MAX_HEIGHT * MAX_WIDTH], CFloatImage refFlow, std::string outFile)
 #else
 void check_results(velocity_t output[MAX_HEIGHT][MAX_WIDTH], CFloatImage refFlow, std::string outFile)
 #endif
 {
-  // copy the output into the float image
-  CFloatImage outFlow(MAX_WIDTH, MAX_HEIGHT, 2);
+  // copy the output into the flow image (straight into a .flo file)
+  CFloatImage outFlow;
+  bool mapped = create_output(outFlow, outFile);
   for (int i = 0; i < MAX_HEIGHT; i++) 
   {
+    float *out = outFlow.Row(i).Data();   // x, y interleaved
     for (int j = 0; j < MAX_WIDTH; j++) 
     {
       #ifdef OCL
@@ -33,48 +111,67 @@ void check_results(velocity_t output[MAX_HEIGHT][MAX_WIDTH], CFloatImage refFlow
         double out_y = output[i][j].y.to_double();
       #endif
 
-      if (out_x*out_x + out_y*out_y > 25.0) 
-      {
-        outFlow.Pixel(j, i, 0) = 1e10;
-        outFlow.Pixel(j, i, 1) = 1e10;
-      } 
-      else 
-      {
-        outFlow.Pixel(j, i, 0) = out_x;
-        outFlow.Pixel(j, i, 1) = out_y;
-      }
+      bool too_big = out_x*out_x + out_y*out_y > 25.0;
+      out[2*j]     = too_big ? 1e10 : out_x;
+      out[2*j + 1] = too_big ? 1e10 : out_y;
     }
   }
 
-  WriteFlowFile(outFlow, outFile.c_str());
+  if (!mapped)
+    WriteFlowFile(outFlow, outFile.c_str());
+  print_error(outFlow, refFlow);
+}
 
-  double accum_error = 0;
-  int num_pix = 0;
+// the packed 16-bit output of optical_flow_packed()
+void check_results(bit32 output[MAX_HEIGHT][MAX_WIDTH], int frac_bits, CFloatImage refFlow, std::string outFile)
+{
+  CFloatImage outFlow;
+  bool mapped = create_output(outFlow, outFile);
+  double scale = 1.0 / (1 << frac_bits);
   for (int i = 0; i < MAX_HEIGHT; i++) 
   {
+    float *out = outFlow.Row(i).Data();   // x, y interleaved
     for (int j = 0; j < MAX_WIDTH; j++) 
     {
-      double out_x = outFlow.Pixel(j, i, 0);
-      double out_y = outFlow.Pixel(j, i, 1);
+      unsigned int word = output[i][j].to_uint();
+      double out_x = (short) (word & 0xffff) * scale;
+      double out_y = (short) (word >> 16) * scale;
 
-      if (unknown_flow(out_x, out_y)) continue;
+      bool too_big = out_x*out_x + out_y*out_y > 25.0;
+      out[2*j]     = too_big ? 1e10 : out_x;
+      out[2*j + 1] = too_big ? 1e10 : out_y;
+    }
+  }
 
-      double out_deg = atan2(-out_y, -out_x) * 180.0 / M_PI;
-      double ref_x = refFlow.Pixel(j, i, 0);
-      double ref_y = refFlow.Pixel(j, i, 1);
-      double ref_deg = atan2(-ref_y, -ref_x) * 180.0 / M_PI;
+  if (!mapped)
+    WriteFlowFile(outFlow, outFile.c_str());
+  print_error(outFlow, refFlow);
+}
 
-      // Normalize error to [-180, 180]
-      double error = out_deg - ref_deg;
-      while (error < -180) error += 360;
-      while (error > 180) error -= 360;
 
-      accum_error += fabs(error);
-      num_pix++;
+// the planar output of optical_flow_planar(), rows pitch vectors apart
+void check_results(vel_pixel_t output_x[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                   vel_pixel_t output_y[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                   int pitch, CFloatImage refFlow, std::string outFile)
+{
+  // unit-stride float planes, too-big vectors marked unknown
+  std::vector<float> flow_x(MAX_HEIGHT * MAX_WIDTH);
+  std::vector<float> flow_y(MAX_HEIGHT * MAX_WIDTH);
+  for (int i = 0; i < MAX_HEIGHT; i++) 
+  {
+    float *out_x = &flow_x[i * MAX_WIDTH];
+    float *out_y = &flow_y[i * MAX_WIDTH];
+    for (int j = 0; j < MAX_WIDTH; j++) 
+    {
+      double x = output_x[i * pitch + j].to_double();
+      double y = output_y[i * pitch + j].to_double();
+
+      bool too_big = x*x + y*y > 25.0;
+      out_x[j] = too_big ? 1e10 : x;
+      out_y[j] = too_big ? 1e10 : y;
     }
   }
 
-  double avg_error = accum_error / num_pix;
-  printf("Average error: %lf degrees\n", avg_error);
-
+  WriteFlowFile(&flow_x[0], &flow_y[0], MAX_WIDTH, MAX_WIDTH, MAX_HEIGHT, outFile.c_str());
+  print_error(&flow_x[0], &flow_y[0], MAX_WIDTH, refFlow);
 }
@@ -19,4 +19,12 @@ void check_results(velocity_t output[MAX_HEIGHT * MAX_WIDTH], CFloatImage refFlo
 void check_results(velocity_t output[MAX_HEIGHT][MAX_WIDTH], CFloatImage refFlow, std::string outFile);
 #endif
 
+// the packed 16-bit output of optical_flow_packed(), unpacked with frac_bits
+void check_results(bit32 output[MAX_HEIGHT][MAX_WIDTH], int frac_bits, CFloatImage refFlow, std::string outFile);
+
+// the planar output of optical_flow_planar(), rows pitch vectors apart
+void check_results(vel_pixel_t output_x[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                   vel_pixel_t output_y[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                   int pitch, CFloatImage refFlow, std::string outFile);
+
 #endif
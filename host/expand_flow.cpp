@@ -0,0 +1,49 @@
+/*===============================================================*/
+/*                                                               */
+/*                       expand_flow.cpp                         */
+/*                                                               */
+/*      Spread a decimated flow field back to full resolution    */
+/*                                                               */
+/*===============================================================*/
+
+#include "expand_flow.h"
+
+void expand_flow(velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                 int height, int width, int decimate)
+{
+  if (decimate <= 1)
+    return;
+  int small_height = height / decimate;
+  int small_width = width / decimate;
+
+  // bottom-up and right-to-left, so every source vector is read
+  // before its own slot is overwritten
+  for (int r = height - 1; r >= 0; r--)
+  {
+    int sr = r / decimate;
+    for (int c = width - 1; c >= 0; c--)
+    {
+      int sc = c / decimate;
+      if (sr < small_height && sc < small_width)
+        outputs[r][c] = outputs[sr][sc];
+      else
+        outputs[r][c].x = outputs[r][c].y = 0;
+    }
+  }
+}
+
+void expand_blocks(block_flow_t blocks[MAX_HEIGHT/MIN_BLOCK][MAX_WIDTH/MIN_BLOCK],
+                   velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                   int height, int width, int block)
+{
+  int block_rows = height / block;
+  int block_cols = width / block;
+  for (int r = 0; r < height; r++)
+    for (int c = 0; c < width; c++)
+    {
+      if (r / block < block_rows && c / block < block_cols)
+        outputs[r][c] = blocks[r / block][c / block].flow;
+      else
+        outputs[r][c].x = outputs[r][c].y = 0;
+    }
+}
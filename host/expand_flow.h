@@ -0,0 +1,28 @@
+/*===============================================================*/
+/*                                                               */
+/*                        expand_flow.h                          */
+/*                                                               */
+/*      Spread a decimated flow field back to full resolution    */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __EXPAND_FLOW_H__
+#define __EXPAND_FLOW_H__
+
+#include "typedefs.h"
+
+// In place: the (height/decimate) x (width/decimate) field the kernel
+// leaves in the top-left corner of outputs is replicated over
+// height x width, every vector covering its decimate x decimate block.
+// Rows and columns past the last whole block get zero flow.
+void expand_flow(velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                 int height, int width, int decimate);
+
+// The block-aggregated field of optical_flow_blocks() spread over the
+// height x width flow raster it was computed on, every block vector
+// covering its block x block tile (zero past the last whole tile).
+void expand_blocks(block_flow_t blocks[MAX_HEIGHT/MIN_BLOCK][MAX_WIDTH/MIN_BLOCK],
+                   velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                   int height, int width, int block);
+
+#endif
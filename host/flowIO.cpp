@@ -18,6 +18,32 @@
 //          the float values for u and v, interleaved, in row order, i.e.,
 //          u[row0,col0], v[row0,col0], u[row0,col1], v[row0,col1], ...
 //
+// ".flz" file format, the compressed alternative
+//
+// Each component is quantized to an integer number of 1/2^fracBits pixels
+// (clamped to +-2^29) and predicted from the already coded neighbours
+// (median of left, up and left + up - upleft, as in LOCO-I), where unknown
+// pixels count as 0.  The residuals are zigzag mapped to unsigned values
+// and stored byte-aligned in groups of four, u and v of two pixels: a
+// control byte holding a 2-bit length code per residual (bits 1-0 for the
+// first; codes 0-3 mean 0, 1, 2 or 4 bytes, 0 bytes for a zero residual),
+// followed by the residual bytes, least significant first.  Each row is
+//
+//  1 byte              1 if the row has unknown flow, else 0
+//  (width+7)/8 bytes   only if 1: the unknown mask, bit x%8 of byte x/8
+//                      set for unknown pixel x
+//  (width+1)/2 groups  the residuals of the row (the last group of an odd
+//                      width holds one pixel); unknown pixels are coded
+//                      as the value 0
+//
+//  bytes  contents
+//
+//  0-3     tag: "PIEZ" in ASCII
+//  4-7     width as an integer
+//  8-11    height as an integer
+//  12-15   fracBits as an integer
+//  16-end  the rows in row order
+//
 
 
 // first four bytes, should be the same in little endian
@@ -28,8 +54,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "imageLib.h"
 #include "flowIO.h"
+#include <vector>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+// size of the header (tag, width, height) in front of the data
+#define FLO_HEADER_SIZE 12
+
+#define FLZ_TAG_STRING "PIEZ"
+#define FLZ_HEADER_SIZE 16
+#define FLZ_MAX_QUANT (1 << 29)  // quantized values are clamped to +-this
+#define FLZ_GROUP_BYTES 17       // largest residual group (control byte + 4 x 4)
+
+// whether filename ends in ext
+static bool HasExtension(const char* filename, const char* ext)
+{
+    const char *dot = strrchr(filename, '.');
+    return dot != NULL && strcmp(dot, ext) == 0;
+}
 
 // return whether flow vector is unknown
 bool unknown_flow(float u, float v) {
@@ -48,9 +106,14 @@ void ReadFlowFile(CFloatImage& img, const char* filename)
     if (filename == NULL)
 	throw CError("ReadFlowFile: empty filename");
 
+    if (HasExtension(filename, ".flz")) {
+	ReadFlowFileCompressed(img, filename);
+	return;
+    }
+
     const char *dot = strrchr(filename, '.');
-    if (strcmp(dot, ".flo") != 0)
-	throw CError("ReadFlowFile (%s): extension .flo expected", filename);
+    if (dot == NULL || strcmp(dot, ".flo") != 0)
+	throw CError("ReadFlowFile (%s): extension .flo or .flz expected", filename);
 
     FILE *stream = fopen(filename, "rb");
     if (stream == 0)
@@ -79,10 +142,10 @@ void ReadFlowFile(CFloatImage& img, const char* filename)
     img.ReAllocate(sh);
 
     //printf("reading %d x %d x 2 = %d floats\n", width, height, width*height*2);
-    int n = nBands * width;
     for (int y = 0; y < height; y++) {
-	float* ptr = &img.Pixel(0, y, 0);
-	if ((int)fread(ptr, sizeof(float), n, stream) != n)
+	CRowSpan<float> row = img.Row(y);
+	int n = row.Size();
+	if ((int)fread(row.Data(), sizeof(float), n, stream) != n)
 	    throw CError("ReadFlowFile(%s): file is too short", filename);
     }
 
@@ -92,18 +155,165 @@ void ReadFlowFile(CFloatImage& img, const char* filename)
     fclose(stream);
 }
 
-// write a 2-band image into flow file 
-void WriteFlowFile(CFloatImage img, const char* filename)
+// total size of a flow file with the given dimensions
+static size_t FlowFileSize(int width, int height)
+{
+    return FLO_HEADER_SIZE + (size_t) width * height * 2 * sizeof(float);
+}
+
+// a mapped flow file, owned by the images created by ReadFlowFileMapped
+// and CreateFlowFileMapped (the length is kept here rather than read
+// back from the header, which someone may have rewritten meanwhile);
+// a created file keeps its temporary name until it is released
+struct CFlowMapping
+{
+    void *base;
+    size_t nBytes;
+    std::string tmpName, filename;
+};
+
+static void UnmapFlowFile(void *ptr)
+{
+    CFlowMapping *mapping = (CFlowMapping *) ptr;
+    if (mapping->tmpName.empty()) {
+	munmap(mapping->base, mapping->nBytes);
+	delete mapping;
+	return;
+    }
+
+    // the data is complete now: put it on disk, then in place of the
+    // old file (a release cannot throw, so a failure is only reported)
+    bool synced = msync(mapping->base, mapping->nBytes, MS_SYNC) == 0;
+    munmap(mapping->base, mapping->nBytes);
+    if (!synced || rename(mapping->tmpName.c_str(), mapping->filename.c_str()) != 0) {
+	unlink(mapping->tmpName.c_str());
+	fprintf(stderr, "CreateFlowFileMapped: could not write %s\n", mapping->filename.c_str());
+    }
+    delete mapping;
+}
+
+// wrap the data of a mapped flow file in img; tmpName, if given, is
+// renamed to filename when the mapping is released
+static void WrapFlowMapping(CFloatImage& img, void *base, size_t nBytes,
+			    int width, int height,
+			    const char *tmpName = 0, const char *filename = 0)
+{
+    CFlowMapping *mapping = new CFlowMapping;
+    mapping->base = base;
+    mapping->nBytes = nBytes;
+    if (tmpName != 0) {
+	mapping->tmpName = tmpName;
+	mapping->filename = filename;
+    }
+
+    int nBands = 2;
+    CShape sh(width, height, nBands);
+    img.ReAllocate(sh, (float *) ((char *) base + FLO_HEADER_SIZE), true,
+		   nBands * width * sizeof(float), UnmapFlowFile, mapping);
+}
+
+// map a flow file into memory; img shares the (copy-on-write) file data
+void ReadFlowFileMapped(CFloatImage& img, const char* filename)
 {
     if (filename == NULL)
-	throw CError("WriteFlowFile: empty filename");
+	throw CError("ReadFlowFileMapped: empty filename");
+
+    const char *dot = strrchr(filename, '.');
+    if (dot == NULL || strcmp(dot, ".flo") != 0)
+	throw CError("ReadFlowFileMapped (%s): extension .flo expected", filename);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        throw CError("ReadFlowFileMapped: could not open %s", filename);
+
+    struct stat st;
+    char header[FLO_HEADER_SIZE];
+    if (fstat(fd, &st) != 0 ||
+	read(fd, header, FLO_HEADER_SIZE) != FLO_HEADER_SIZE) {
+	close(fd);
+	throw CError("ReadFlowFileMapped: problem reading file %s", filename);
+    }
+
+    float tag = *(float *) header;
+    int width = *(int *) (header + 4);
+    int height = *(int *) (header + 8);
+
+    if (tag != TAG_FLOAT || width < 1 || width > 99999 ||
+	height < 1 || height > 99999) {
+	close(fd);
+	throw CError("ReadFlowFileMapped(%s): wrong tag or illegal size", filename);
+    }
+
+    size_t nBytes = FlowFileSize(width, height);
+    if ((size_t) st.st_size != nBytes) {
+	close(fd);
+	throw CError("ReadFlowFileMapped(%s): file is too short or too long", filename);
+    }
+
+    // private mapping: writes to img never reach the file
+    void *base = mmap(0, nBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+	throw CError("ReadFlowFileMapped: could not map %s", filename);
+
+    WrapFlowMapping(img, base, nBytes, width, height);
+}
+
+// create a flow file of the given size and map img onto its data
+void CreateFlowFileMapped(CFloatImage& img, const char* filename,
+			  int width, int height)
+{
+    if (filename == NULL)
+	throw CError("CreateFlowFileMapped: empty filename");
 
     const char *dot = strrchr(filename, '.');
     if (dot == NULL)
-	throw CError("WriteFlowFile: extension required in filename '%s'", filename);
+	throw CError("CreateFlowFileMapped: extension required in filename '%s'", filename);
 
     if (strcmp(dot, ".flo") != 0)
-	throw CError("WriteFlowFile: filename '%s' should have extension '.flo'", filename);
+	throw CError("CreateFlowFileMapped: filename '%s' should have extension '.flo'", filename);
+
+    if (width < 1 || width > 99999 || height < 1 || height > 99999)
+	throw CError("CreateFlowFileMapped(%s): illegal size", filename);
+
+    // a new file, renamed over the old one once img has been filled and
+    // released: images still mapping the old file (with
+    // ReadFlowFileMapped, say) keep their data instead of faulting on a
+    // file that was resized underneath them, and readers never see a
+    // half-written file
+    static std::atomic<int> serial(0);
+    std::vector<char> tmpName(strlen(filename) + 32);
+    snprintf(&tmpName[0], tmpName.size(), "%s.%d.%d.tmp", filename,
+	     (int) getpid(), serial++);
+    int fd = open(&tmpName[0], O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0)
+        throw CError("CreateFlowFileMapped: could not create %s", filename);
+
+    // allocate the blocks up front (a sparse file would fault on a full
+    // disk while img is written), then map it
+    size_t nBytes = FlowFileSize(width, height);
+    void *base = MAP_FAILED;
+    if (posix_fallocate(fd, 0, nBytes) == 0)
+	base = mmap(0, nBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+	unlink(&tmpName[0]);
+	throw CError("CreateFlowFileMapped(%s): could not allocate file", filename);
+    }
+
+    // write the header
+    memcpy(base, TAG_STRING, 4);
+    ((int *) base)[1] = width;
+    ((int *) base)[2] = height;
+
+    WrapFlowMapping(img, base, nBytes, width, height, &tmpName[0], filename);
+}
+
+// write a 2-band image into flow file 
+void WriteFlowFile(CFloatImage& img, const char* filename)
+{
+    if (filename == NULL)
+	throw CError("WriteFlowFile: empty filename");
 
     CShape sh = img.Shape();
     int width = sh.width, height = sh.height, nBands = sh.nBands;
@@ -111,25 +321,547 @@ void WriteFlowFile(CFloatImage img, const char* filename)
     if (nBands != 2)
 	throw CError("WriteFlowFile(%s): image must have 2 bands", filename);
 
+    if (HasExtension(filename, ".flz")) {
+	WriteFlowFileCompressed(img, filename);
+	return;
+    }
+
+    // copy the rows into a preallocated, mapped output file
+    CFloatImage out;
+    CreateFlowFileMapped(out, filename, width, height);
+
+    for (int y = 0; y < height; y++)
+	memcpy(out.Row(y).Data(), img.Row(y).Data(), img.Row(y).Size() * sizeof(float));
+}
+
+// interleave the x and y planes into the rows of a 2-band image
+static void InterleavePlanes(CFloatImage& img, const float *x, const float *y, int pitch)
+{
+    CShape sh = img.Shape();
+    for (int r = 0; r < sh.height; r++) {
+	const float *px = x + (size_t) r * pitch;
+	const float *py = y + (size_t) r * pitch;
+	float *out = img.Row(r).Data();
+	for (int c = 0; c < sh.width; c++) {
+	    out[2*c]     = px[c];
+	    out[2*c + 1] = py[c];
+	}
+    }
+}
+
+void WriteFlowFile(const float *x, const float *y, int pitch,
+		   int width, int height, const char* filename)
+{
+    if (filename == NULL)
+	throw CError("WriteFlowFile: empty filename");
+
+    if (pitch < width)
+	throw CError("WriteFlowFile(%s): pitch is less than the width", filename);
+
+    CFloatImage out;
+    if (HasExtension(filename, ".flz")) {
+	out.ReAllocate(CShape(width, height, 2));
+	InterleavePlanes(out, x, y, pitch);
+	WriteFlowFileCompressed(out, filename);
+	return;
+    }
+
+    // interleave straight into the mapped output file
+    CreateFlowFileMapped(out, filename, width, height);
+    InterleavePlanes(out, x, y, pitch);
+}
+
+
+// median predictor of LOCO-I: the median of left, up and
+// left + up - upleft (written with min/max so it compiles branch-free;
+// the sum wraps instead of overflowing on a corrupt file)
+static inline int PredictMED(int a, int b, int c)
+{
+    int mx = a > b ? a : b;
+    int mn = a < b ? a : b;
+    int g = (int) ((unsigned int) a + (unsigned int) b - (unsigned int) c);
+    g = g < mx ? g : mx;
+    return g > mn ? g : mn;
+}
+
+// !unknown_flow(u, v) without the double conversions (NaN fails both tests)
+static inline bool KnownFlow(float u, float v)
+{
+    return fabsf(u) <= (float) UNKNOWN_FLOW_THRESH && fabsf(v) <= (float) UNKNOWN_FLOW_THRESH;
+}
+
+static inline unsigned int ZigZag(int v)
+{
+    return ((unsigned int) v << 1) ^ (unsigned int) (v >> 31);
+}
+
+static inline int UnZigZag(unsigned int z)
+{
+    return (int) (z >> 1) ^ -(int) (z & 1);
+}
+
+static inline int Quantize(float f, float scale)
+{
+    float q = f * scale;
+    q = q < -FLZ_MAX_QUANT ? -FLZ_MAX_QUANT : (q > FLZ_MAX_QUANT ? FLZ_MAX_QUANT : q);
+    return (int) (q + (q < 0 ? -0.5f : 0.5f));   // round half away from zero
+}
+
+// length code of a zigzag coded residual, and bytes per code
+static inline int LengthCode(unsigned int z)
+{
+    return (z != 0) + (z > 0xff) + (z > 0xffff);
+}
+static const int FLZ_LENGTH[4] = { 0, 1, 2, 4 };
+
+// layout of a residual group, by control byte
+struct CFlzGroupTable
+{
+    unsigned char offset[256][4];   // where each residual starts
+    unsigned int mask[256][4];      // its bytes in a 4-byte load
+    unsigned char size[256];        // bytes after the control byte
+    unsigned char pack[256][16];    // pshufb: residuals -> group bytes
+    unsigned char unpack[256][16];  // pshufb: group bytes -> residuals
+
+    CFlzGroupTable(void)
+    {
+	static const unsigned int lengthMask[4] = { 0, 0xff, 0xffff, 0xffffffff };
+	memset(pack, 0x80, sizeof(pack));
+	memset(unpack, 0x80, sizeof(unpack));
+	for (int c = 0; c < 256; c++) {
+	    int at = 0;
+	    for (int i = 0; i < 4; i++) {
+		int code = (c >> (2*i)) & 3;
+		offset[c][i] = (unsigned char) at;
+		mask[c][i] = lengthMask[code];
+		for (int b = 0; b < FLZ_LENGTH[code]; b++) {
+		    pack[c][at + b] = (unsigned char) (4*i + b);
+		    unpack[c][4*i + b] = (unsigned char) (at + b);
+		}
+		at += FLZ_LENGTH[code];
+	    }
+	    size[c] = (unsigned char) at;
+	}
+    }
+};
+static const CFlzGroupTable flzGroups;
+
+// quantized rows of both components, one pixel of padding on the left
+struct CFlzRows
+{
+    std::vector<int> buf;
+    int *prevU, *prevV, *curU, *curV;
+
+    CFlzRows(int width) : buf(4 * (width + 1), 0)
+    {
+	prevU = &buf[1];
+	prevV = &buf[(width + 1) + 1];
+	curU = &buf[2 * (width + 1) + 1];
+	curV = &buf[3 * (width + 1) + 1];
+    }
+
+    // left of column 0 is the pixel above it, so upleft equals up there
+    void StartRow(void)
+    {
+	curU[-1] = prevU[-1] = prevU[0];
+	curV[-1] = prevV[-1] = prevV[0];
+    }
+
+    void EndRow(void)
+    {
+	std::swap(prevU, curU);
+	std::swap(prevV, curV);
+    }
+};
+
+#ifdef __SSE2__
+// m ? a : b, lane by lane
+static inline __m128i SelectSSE(__m128i m, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+// PredictMED on four lanes
+static inline __m128i PredictMEDSSE(__m128i a, __m128i b, __m128i c)
+{
+    __m128i agtb = _mm_cmpgt_epi32(a, b);
+    __m128i mx = SelectSSE(agtb, a, b);
+    __m128i mn = SelectSSE(agtb, b, a);
+    __m128i g = _mm_sub_epi32(_mm_add_epi32(a, b), c);
+    g = SelectSSE(_mm_cmpgt_epi32(g, mx), mx, g);
+    return SelectSSE(_mm_cmpgt_epi32(mn, g), mn, g);
+}
+
+static inline __m128i ZigZagSSE(__m128i r)
+{
+    return _mm_xor_si128(_mm_slli_epi32(r, 1), _mm_srai_epi32(r, 31));
+}
+#endif
+
+// quantize one row into cur (unknown pixels become 0, and their bit in
+// mask is set) and store the zigzag coded residuals of u and v,
+// interleaved, in z; returns the number of unknown pixels
+static int EncodeRowFLZ(const float *row, int width, float scale, CFlzRows& rows,
+			unsigned char *mask, unsigned int *z)
+{
+    const int *prevU = rows.prevU, *prevV = rows.prevV;
+    int *curU = rows.curU, *curV = rows.curV;
+    int nUnknown = 0, x = 0;
+#ifdef __SSE2__
+    const __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+    const __m128 thresh = _mm_set1_ps((float) UNKNOWN_FLOW_THRESH);
+    const __m128 maxq = _mm_set1_ps((float) FLZ_MAX_QUANT);
+    const __m128 minq = _mm_set1_ps((float) -FLZ_MAX_QUANT);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 s = _mm_set1_ps(scale);
+    // the left neighbour of the next block is in the last lane
+    __m128i leftU = _mm_slli_si128(_mm_cvtsi32_si128(curU[-1]), 12);
+    __m128i leftV = _mm_slli_si128(_mm_cvtsi32_si128(curV[-1]), 12);
+    for (; x + 4 <= width; x += 4) {
+	__m128 a = _mm_loadu_ps(&row[2*x]);
+	__m128 b = _mm_loadu_ps(&row[2*x + 4]);
+	__m128 u = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+	__m128 v = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+	__m128 known = _mm_and_ps(_mm_cmple_ps(_mm_and_ps(u, abs), thresh),
+				  _mm_cmple_ps(_mm_and_ps(v, abs), thresh));
+	int unknownBits = ~_mm_movemask_ps(known) & 15;
+	nUnknown += unknownBits != 0;
+	mask[x >> 3] |= (unsigned char) (unknownBits << (x & 7));
+
+	// clamp, round half away from zero, truncate
+	u = _mm_min_ps(_mm_max_ps(_mm_mul_ps(u, s), minq), maxq);
+	v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(v, s), minq), maxq);
+	u = _mm_add_ps(u, _mm_or_ps(half, _mm_and_ps(u, sign)));
+	v = _mm_add_ps(v, _mm_or_ps(half, _mm_and_ps(v, sign)));
+	__m128i qu = _mm_and_si128(_mm_cvttps_epi32(u), _mm_castps_si128(known));
+	__m128i qv = _mm_and_si128(_mm_cvttps_epi32(v), _mm_castps_si128(known));
+	_mm_storeu_si128((__m128i *) &curU[x], qu);
+	_mm_storeu_si128((__m128i *) &curV[x], qv);
+
+	__m128i lu = _mm_or_si128(_mm_slli_si128(qu, 4), _mm_srli_si128(leftU, 12));
+	__m128i lv = _mm_or_si128(_mm_slli_si128(qv, 4), _mm_srli_si128(leftV, 12));
+	leftU = qu;
+	leftV = qv;
+	__m128i upU = _mm_loadu_si128((const __m128i *) &prevU[x]);
+	__m128i upV = _mm_loadu_si128((const __m128i *) &prevV[x]);
+	__m128i ulU = _mm_loadu_si128((const __m128i *) &prevU[x - 1]);
+	__m128i ulV = _mm_loadu_si128((const __m128i *) &prevV[x - 1]);
+	__m128i zu = ZigZagSSE(_mm_sub_epi32(qu, PredictMEDSSE(lu, upU, ulU)));
+	__m128i zv = ZigZagSSE(_mm_sub_epi32(qv, PredictMEDSSE(lv, upV, ulV)));
+	_mm_storeu_si128((__m128i *) &z[2*x], _mm_unpacklo_epi32(zu, zv));
+	_mm_storeu_si128((__m128i *) &z[2*x + 4], _mm_unpackhi_epi32(zu, zv));
+    }
+#endif
+    for (; x < width; x++) {
+	float u = row[2*x], v = row[2*x + 1];
+	bool k = KnownFlow(u, v);
+	nUnknown += !k;
+	mask[x >> 3] |= (unsigned char) (!k << (x & 7));
+	curU[x] = k ? Quantize(u, scale) : 0;
+	curV[x] = k ? Quantize(v, scale) : 0;
+	z[2*x]     = ZigZag(curU[x] - PredictMED(curU[x - 1], prevU[x], prevU[x - 1]));
+	z[2*x + 1] = ZigZag(curV[x] - PredictMED(curV[x - 1], prevV[x], prevV[x - 1]));
+    }
+    return nUnknown;
+}
+
+// store groups of four residuals from z at p; returns the end
+static unsigned char *PackGroupsFLZ(const unsigned int *z, int groups, unsigned char *p)
+{
+    int g = 0;
+#ifdef __SSSE3__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(0x7f), two = _mm_set1_epi32(0x7fff);
+    for (; g < groups; g++) {
+	__m128i zg = _mm_loadu_si128((const __m128i *) &z[4*g]);
+	// code = nonzero + over 1 byte + over 2 bytes, each test giving -1
+	__m128i h = _mm_srli_epi32(zg, 1);
+	__m128i code = _mm_add_epi32(_mm_cmpgt_epi32(h, one), _mm_cmpgt_epi32(h, two));
+	code = _mm_sub_epi32(_mm_sub_epi32(_mm_cmpeq_epi32(zg, zero), code), _mm_set1_epi32(-1));
+	code = _mm_packs_epi32(code, code);
+	unsigned int w = (unsigned int) _mm_cvtsi128_si32(_mm_packus_epi16(code, code));
+	unsigned int c = (w | (w >> 6) | (w >> 12) | (w >> 18)) & 0xff;
+	*p++ = (unsigned char) c;
+	_mm_storeu_si128((__m128i *) p,
+			 _mm_shuffle_epi8(zg, _mm_loadu_si128((const __m128i *) flzGroups.pack[c])));
+	p += flzGroups.size[c];
+    }
+#endif
+    for (; g < groups; g++) {
+	const unsigned int *zg = &z[4*g];
+	int c0 = LengthCode(zg[0]), c1 = LengthCode(zg[1]);
+	int c2 = LengthCode(zg[2]), c3 = LengthCode(zg[3]);
+	*p++ = (unsigned char) (c0 | (c1 << 2) | (c2 << 4) | (c3 << 6));
+	memcpy(p, &zg[0], 4);
+	p += FLZ_LENGTH[c0];
+	memcpy(p, &zg[1], 4);
+	p += FLZ_LENGTH[c1];
+	memcpy(p, &zg[2], 4);
+	p += FLZ_LENGTH[c2];
+	memcpy(p, &zg[3], 4);
+	p += FLZ_LENGTH[c3];
+    }
+    return p;
+}
+
+// read groups of four residuals at p into z; returns the end (the reads
+// may run up to 16 bytes past it)
+static const unsigned char *UnpackGroupsFLZ(const unsigned char *p, int groups, unsigned int *z)
+{
+    int g = 0;
+#ifdef __SSSE3__
+    for (; g < groups; g++) {
+	unsigned int c = *p++;
+	__m128i bytes = _mm_loadu_si128((const __m128i *) p);
+	_mm_storeu_si128((__m128i *) &z[4*g],
+			 _mm_shuffle_epi8(bytes, _mm_loadu_si128((const __m128i *) flzGroups.unpack[c])));
+	p += flzGroups.size[c];
+    }
+#endif
+    for (; g < groups; g++) {
+	unsigned int c = *p++;
+	for (int i = 0; i < 4; i++) {
+	    memcpy(&z[4*g + i], p + flzGroups.offset[c][i], 4);
+	    z[4*g + i] &= flzGroups.mask[c][i];
+	}
+	p += flzGroups.size[c];
+    }
+    return p;
+}
+
+// encode img (rows only, no header) into stream, a few rows at a time;
+// returns false if a write failed
+static bool EncodeFlowFLZ(CFloatImage& img, int fracBits, FILE *stream)
+{
+    CShape sh = img.Shape();
+    int width = sh.width, height = sh.height;
+    int groups = (width + 1) / 2, maskBytes = (width + 7) / 8;
+    float scale = (float) (1 << fracBits);
+
+    CFlzRows rows(width);
+    std::vector<unsigned char> mask(maskBytes);
+    std::vector<unsigned int> z(4 * groups + 4, 0);    // residuals, u and v interleaved
+
+    // every group is stored with a 16-byte write, hence the slack
+    size_t rowBytes = 1 + maskBytes + (size_t) groups * FLZ_GROUP_BYTES + 16;
+    std::vector<unsigned char> buf(rowBytes + (1 << 16));
+    unsigned char *p = &buf[0];
+    for (int y = 0; y < height; y++) {
+	if ((size_t) (p - &buf[0]) > buf.size() - rowBytes) {
+	    size_t n = p - &buf[0];
+	    if (fwrite(&buf[0], 1, n, stream) != n)
+		return false;
+	    p = &buf[0];
+	}
+
+	rows.StartRow();
+	memset(&mask[0], 0, maskBytes);
+	int nUnknown = EncodeRowFLZ(img.Row(y).Data(), width, scale, rows, &mask[0], &z[0]);
+	z[2*width] = z[2*width + 1] = 0;    // the unused half of an odd last group
+	*p++ = nUnknown > 0;
+	if (nUnknown > 0) {
+	    memcpy(p, &mask[0], maskBytes);
+	    p += maskBytes;
+	}
+	p = PackGroupsFLZ(&z[0], groups, p);
+	rows.EndRow();
+    }
+    size_t n = p - &buf[0];
+    return fwrite(&buf[0], 1, n, stream) == n;
+}
+
+// add the residuals z to the predictions from the row above, prev, and
+// the left neighbour; rows hold u and v interleaved, with the pixel
+// left of column 0 at index -2 (the sums wrap on a corrupt file)
+static void ReconstructRowFLZ(const int *prev, int *cur, const unsigned int *z, int width)
+{
+    int x = 0;
+#ifdef __SSE4_1__
+    // u and v side by side in the low lanes; the chain through the left
+    // neighbour is four single-cycle operations per pixel
+    __m128i a = _mm_loadl_epi64((const __m128i *) &cur[-2]);
+    const __m128i one = _mm_set1_epi32(1), zero = _mm_setzero_si128();
+    for (; x < width; x++) {
+	__m128i b = _mm_loadl_epi64((const __m128i *) &prev[2*x]);
+	__m128i c = _mm_loadl_epi64((const __m128i *) &prev[2*x - 2]);
+	__m128i zz = _mm_loadl_epi64((const __m128i *) &z[2*x]);
+	__m128i r = _mm_xor_si128(_mm_srli_epi32(zz, 1), _mm_sub_epi32(zero, _mm_and_si128(zz, one)));
+	__m128i g = _mm_add_epi32(a, _mm_sub_epi32(b, c));
+	__m128i pred = _mm_max_epi32(_mm_min_epi32(g, _mm_max_epi32(a, b)), _mm_min_epi32(a, b));
+	a = _mm_add_epi32(pred, r);
+	_mm_storel_epi64((__m128i *) &cur[2*x], a);
+    }
+#endif
+    if (x < width) {
+	int qu = cur[2*x - 2], qv = cur[2*x - 1];
+	for (; x < width; x++) {
+	    qu = (int) ((unsigned int) PredictMED(qu, prev[2*x], prev[2*x - 2]) + (unsigned int) UnZigZag(z[2*x]));
+	    qv = (int) ((unsigned int) PredictMED(qv, prev[2*x + 1], prev[2*x - 1]) + (unsigned int) UnZigZag(z[2*x + 1]));
+	    cur[2*x] = qu;
+	    cur[2*x + 1] = qv;
+	}
+    }
+}
+
+// store a decoded row (u and v interleaved), UNKNOWN_FLOW where mask has
+// a bit set; returns false if a value is out of range
+static bool DequantizeRowFLZ(const int *cur, const unsigned char *mask, int width,
+			     float step, float *row)
+{
+    const float unknown = (float) UNKNOWN_FLOW;
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i bitsLo = _mm_set_epi32(2, 2, 1, 1), bitsHi = _mm_set_epi32(8, 8, 4, 4);
+    const __m128i maxq = _mm_set1_epi32(FLZ_MAX_QUANT), minq = _mm_set1_epi32(-FLZ_MAX_QUANT);
+    const __m128 s = _mm_set1_ps(step), unk = _mm_set1_ps(unknown);
+    __m128i bad = _mm_setzero_si128();
+    for (; x + 4 <= width; x += 4) {
+	__m128i lo = _mm_loadu_si128((const __m128i *) &cur[2*x]);
+	__m128i hi = _mm_loadu_si128((const __m128i *) &cur[2*x + 4]);
+	bad = _mm_or_si128(bad, _mm_or_si128(_mm_cmpgt_epi32(lo, maxq), _mm_cmplt_epi32(lo, minq)));
+	bad = _mm_or_si128(bad, _mm_or_si128(_mm_cmpgt_epi32(hi, maxq), _mm_cmplt_epi32(hi, minq)));
+	__m128i m = _mm_set1_epi32(mask[x >> 3] >> (x & 7));
+	__m128 knownLo = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(m, bitsLo), _mm_setzero_si128()));
+	__m128 knownHi = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(m, bitsHi), _mm_setzero_si128()));
+	__m128 fLo = _mm_mul_ps(_mm_cvtepi32_ps(lo), s);
+	__m128 fHi = _mm_mul_ps(_mm_cvtepi32_ps(hi), s);
+	_mm_storeu_ps(&row[2*x], _mm_or_ps(_mm_and_ps(knownLo, fLo), _mm_andnot_ps(knownLo, unk)));
+	_mm_storeu_ps(&row[2*x + 4], _mm_or_ps(_mm_and_ps(knownHi, fHi), _mm_andnot_ps(knownHi, unk)));
+    }
+    if (_mm_movemask_epi8(bad))
+	return false;
+#endif
+    for (; x < width; x++) {
+	for (int b = 0; b < 2; b++) {
+	    if (cur[2*x + b] < -FLZ_MAX_QUANT || cur[2*x + b] > FLZ_MAX_QUANT)
+		return false;
+	}
+	bool k = !((mask[x >> 3] >> (x & 7)) & 1);
+	row[2*x]     = k ? cur[2*x] * step : unknown;
+	row[2*x + 1] = k ? cur[2*x + 1] * step : unknown;
+    }
+    return true;
+}
+
+// decode the rows in [data, end) into img (already allocated)
+static void DecodeFlowFLZ(const unsigned char *data, const unsigned char *end,
+			  int fracBits, CFloatImage& img)
+{
+    CShape sh = img.Shape();
+    int width = sh.width, height = sh.height;
+    int groups = (width + 1) / 2, maskBytes = (width + 7) / 8;
+    float step = 1.0f / (float) (1 << fracBits);
+
+    // previous and current row, u and v interleaved, with a pixel of
+    // padding on the left
+    std::vector<int> rowBuf(4 * (width + 1), 0);
+    int *prev = &rowBuf[2], *cur = &rowBuf[2 * (width + 1) + 2];
+    std::vector<unsigned char> noMask(maskBytes, 0);
+    std::vector<unsigned int> z(4 * groups + 4);
+
+    // groups are read with loads that may run past the data, so the last
+    // rows are decoded from a zero-padded copy
+    size_t rowBytes = 1 + maskBytes + (size_t) groups * FLZ_GROUP_BYTES + 16;
+    std::vector<unsigned char> tail;
+
+    const unsigned char *p = data;
+    for (int y = 0; y < height; y++) {
+	if ((size_t) (end - p) < rowBytes && tail.empty()) {
+	    tail.assign(p, end);
+	    tail.resize(tail.size() + rowBytes, 0);
+	    end = &tail[0] + (end - p);
+	    p = &tail[0];
+	}
+
+	unsigned char flag = *p++;
+	if (flag > 1)
+	    throw CError("ReadFlowFileCompressed: bad row header");
+	const unsigned char *mask = flag ? p : &noMask[0];
+	p += flag ? maskBytes : 0;
+	p = UnpackGroupsFLZ(p, groups, &z[0]);
+	if (p > end)
+	    throw CError("ReadFlowFileCompressed: data is truncated");
+
+	// prediction plus residual (unknown pixels decode to 0 by
+	// construction); the sums wrap, and a value outside the range the
+	// encoder produces rejects the file
+	// as in CFlzRows::StartRow, left of column 0 is the pixel above it
+	cur[-2] = prev[-2] = prev[0];
+	cur[-1] = prev[-1] = prev[1];
+	ReconstructRowFLZ(prev, cur, &z[0], width);
+	if (!DequantizeRowFLZ(cur, mask, width, step, img.Row(y).Data()))
+	    throw CError("ReadFlowFileCompressed: corrupt data");
+	std::swap(prev, cur);
+    }
+    if (p != end)
+	throw CError("ReadFlowFileCompressed: data is too long");
+}
+
+// write a 2-band image into a compressed flow file
+void WriteFlowFileCompressed(CFloatImage& img, const char* filename, int fracBits)
+{
+    if (filename == NULL)
+	throw CError("WriteFlowFileCompressed: empty filename");
+
+    CShape sh = img.Shape();
+    if (sh.nBands != 2)
+	throw CError("WriteFlowFileCompressed(%s): image must have 2 bands", filename);
+    if (fracBits < 0 || fracBits > 20)
+	throw CError("WriteFlowFileCompressed(%s): fracBits must be 0..20", filename);
+
     FILE *stream = fopen(filename, "wb");
     if (stream == 0)
-        throw CError("WriteFlowFile: could not open %s", filename);
+	throw CError("WriteFlowFileCompressed: could not open %s", filename);
 
-    // write the header
-    fprintf(stream, TAG_STRING);
-    if ((int)fwrite(&width,  sizeof(int),   1, stream) != 1 ||
-	(int)fwrite(&height, sizeof(int),   1, stream) != 1)
-	throw CError("WriteFlowFile(%s): problem writing header", filename);
+    int header[3] = { sh.width, sh.height, fracBits };
+    bool ok = fwrite(FLZ_TAG_STRING, 1, 4, stream) == 4 &&
+	fwrite(header, sizeof(int), 3, stream) == 3 &&
+	EncodeFlowFLZ(img, fracBits, stream);
+    if (fclose(stream) != 0 || !ok)
+	throw CError("WriteFlowFileCompressed: problem writing %s", filename);
+}
 
-    // write the rows
-    int n = nBands * width;
-    for (int y = 0; y < height; y++) {
-	float* ptr = &img.Pixel(0, y, 0);
-	if ((int)fwrite(ptr, sizeof(float), n, stream) != n)
-	    throw CError("WriteFlowFile(%s): problem writing data", filename); 
-   }
+// read a compressed flow file into a 2-band image
+void ReadFlowFileCompressed(CFloatImage& img, const char* filename)
+{
+    if (filename == NULL)
+	throw CError("ReadFlowFileCompressed: empty filename");
 
-    fclose(stream);
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+	throw CError("ReadFlowFileCompressed: could not open %s", filename);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < FLZ_HEADER_SIZE) {
+	close(fd);
+	throw CError("ReadFlowFileCompressed: problem reading file %s", filename);
+    }
+    size_t nBytes = st.st_size;
+    void *base = mmap(0, nBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+	throw CError("ReadFlowFileCompressed: could not map %s", filename);
+
+    const unsigned char *data = (const unsigned char *) base;
+    int header[3];
+    memcpy(header, data + 4, sizeof(header));
+    int width = header[0], height = header[1], fracBits = header[2];
+    if (memcmp(data, FLZ_TAG_STRING, 4) != 0 || width < 1 || width > 99999 ||
+	height < 1 || height > 99999 || fracBits < 0 || fracBits > 20) {
+	munmap(base, nBytes);
+	throw CError("ReadFlowFileCompressed(%s): wrong tag or illegal header", filename);
+    }
+
+    try {
+	img.ReAllocate(CShape(width, height, 2));
+	DecodeFlowFLZ(data + FLZ_HEADER_SIZE, data + nBytes, fracBits, img);
+    }
+    catch (CError &) {
+	munmap(base, nBytes);
+	throw;
+    }
+    munmap(base, nBytes);
 }
 
 
@@ -155,3 +887,170 @@ int main() {
     return 0;
 }
 */
+
+#ifdef FLZ_ROUND_TRIP_CHECK
+// round trip of the .flz format through the file functions; build with
+//   g++ -O2 -DFLZ_ROUND_TRIP_CHECK flowIO.cpp Image.cpp ImagePool.cpp RefCntMem.cpp
+// (add -march=native for the SIMD paths, whose files must not differ)
+
+static int flzFailures = 0;
+
+static void FlzCheck(bool ok, const char *what, int width, int height)
+{
+    if (!ok) {
+	fprintf(stderr, "%dx%d: %s\n", width, height, what);
+	flzFailures++;
+    }
+}
+
+// fill img with smooth flow plus noise, then apply a pattern of unknown
+// flow: runs across group and mask byte boundaries, whole rows, the first
+// and last columns, NaN, and values past the quantizer's clamp
+static void FlzPattern(CFloatImage& img, float noise, int pattern)
+{
+    CShape sh = img.Shape();
+    for (int y = 0; y < sh.height; y++) {
+	for (int x = 0; x < sh.width; x++) {
+	    float *f = &img.Pixel(x, y, 0);
+	    f[0] = 3.0f * sinf(x * 0.01f) + 2.0f * cosf(y * 0.013f) + noise * (rand() / (float) RAND_MAX - 0.5f);
+	    f[1] = 1.5f * cosf(x * 0.007f + y * 0.004f) + noise * (rand() / (float) RAND_MAX - 0.5f);
+	    bool unknown = false;
+	    if (pattern == 1)
+		unknown = (x / 5 + y) % 3 == 0;                 // short runs
+	    else if (pattern == 2)
+		unknown = y % 4 == 1 || x == 0 || x == sh.width - 1;
+	    else if (pattern == 3)
+		unknown = x >= 7 && x < 7 + 2 * sh.width / 3;   // long runs
+	    else if (pattern == 4)
+		unknown = rand() % 2 == 0;
+	    if (unknown && (x + y) % 5 == 0)
+		f[(x + y) & 1] = NAN;
+	    else if (unknown)
+		f[(x + y) & 1] = (x & 2) ? UNKNOWN_FLOW : -2e9f;
+	    else if (pattern == 4 && x % 7 == 3)
+		f[y & 1] = (y & 2) ? 3e6f : -3e6f;              // clamped at fracBits 8
+	}
+    }
+}
+
+static void FlzRoundTrip(int width, int height, int fracBits, float noise, int pattern)
+{
+    const char *filename = "flz_round_trip.flz";
+    CFloatImage img(CShape(width, height, 2)), out;
+    FlzPattern(img, noise, pattern);
+    WriteFlowFileCompressed(img, filename, fracBits);
+    ReadFlowFileCompressed(out, filename);
+
+    float limit = (float) FLZ_MAX_QUANT / (1 << fracBits);
+    float tolerance = 0.5f / (1 << fracBits) * 1.0001f;
+    bool sameMask = true, close = true;
+    for (int y = 0; y < height; y++) {
+	for (int x = 0; x < width; x++) {
+	    float *a = &img.Pixel(x, y, 0), *b = &out.Pixel(x, y, 0);
+	    bool unknown = unknown_flow(a);
+	    sameMask &= unknown == unknown_flow(b) && (!unknown || (b[0] == (float) UNKNOWN_FLOW && b[1] == (float) UNKNOWN_FLOW));
+	    for (int c = 0; c < 2 && !unknown; c++) {
+		float expect = std::min(std::max(a[c], -limit), limit);
+		close &= fabsf(b[c] - expect) <= tolerance * std::max(1.0f, fabsf(expect) / 1e5f);
+	    }
+	}
+    }
+    FlzCheck(sameMask, "unknown flow differs", width, height);
+    FlzCheck(close, "known flow out of tolerance", width, height);
+}
+
+// damaged copies of a file must be rejected, or at least decode safely
+static void FlzCorrupt(int width, int height)
+{
+    const char *filename = "flz_round_trip.flz";
+    CFloatImage img(CShape(width, height, 2)), out;
+    FlzPattern(img, 0.25f, 1);
+    WriteFlowFileCompressed(img, filename);
+    FILE *stream = fopen(filename, "rb");
+    std::vector<unsigned char> data(1 << 24);
+    size_t n = fread(&data[0], 1, data.size(), stream);
+    fclose(stream);
+
+    for (int trial = 0; trial < 200; trial++) {
+	std::vector<unsigned char> bad(data.begin(), data.begin() + n);
+	bool mustFail = true;
+	if (trial == 0)
+	    bad.pop_back();                                     // truncated
+	else if (trial == 1)
+	    bad.push_back(0);                                   // too long
+	else if (trial == 2)
+	    bad[FLZ_HEADER_SIZE] = 2;                           // bad row flag
+	else {
+	    // random bytes in the rows, and a run of 4-byte residuals
+	    mustFail = false;
+	    size_t at = FLZ_HEADER_SIZE + rand() % (n - FLZ_HEADER_SIZE);
+	    bad[at] = (unsigned char) rand();
+	    if (trial % 2 == 0)
+		for (size_t i = at; i < std::min(n, at + 64); i++)
+		    bad[i] = 0xff;
+	}
+	stream = fopen(filename, "wb");
+	fwrite(&bad[0], 1, bad.size(), stream);
+	fclose(stream);
+	bool failed = false;
+	try {
+	    ReadFlowFileCompressed(out, filename);
+	}
+	catch (CError &) {
+	    failed = true;
+	}
+	FlzCheck(failed || !mustFail, "damaged file accepted", width, height);
+    }
+}
+
+// a residual that takes a value past the clamp must be rejected
+static void FlzOutOfRange(int width)
+{
+    const char *filename = "flz_round_trip.flz";
+    int header[3] = { width, 1, 8 };
+    std::vector<unsigned char> row(1, 0);
+    for (int g = 0; g < (width + 1) / 2; g++) {
+	row.push_back(g == (width - 1) / 2 ? 0x03 : 0);   // u of the last pixels
+	if (g == (width - 1) / 2)
+	    for (int i = 0; i < 4; i++)
+		row.push_back(i < 3 ? 0xff : 0x7f);      // zigzag of -2^30
+    }
+    FILE *stream = fopen(filename, "wb");
+    fwrite(FLZ_TAG_STRING, 1, 4, stream);
+    fwrite(header, sizeof(int), 3, stream);
+    fwrite(&row[0], 1, row.size(), stream);
+    fclose(stream);
+    bool failed = false;
+    CFloatImage out;
+    try {
+	ReadFlowFileCompressed(out, filename);
+    }
+    catch (CError &) {
+	failed = true;
+    }
+    FlzCheck(failed, "out of range value accepted", width, 1);
+}
+
+int main() {
+    static const int sizes[][2] = { {1, 1}, {1, 9}, {2, 3}, {3, 2}, {5, 7}, {7, 5}, {8, 8},
+				    {9, 4}, {17, 3}, {33, 33}, {640, 480}, {1024, 436} };
+    srand(1);
+    try {
+	for (int s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); s++) {
+	    for (int pattern = 0; pattern < 5; pattern++) {
+		FlzRoundTrip(sizes[s][0], sizes[s][1], 8, 0.01f, pattern);
+		FlzRoundTrip(sizes[s][0], sizes[s][1], pattern * 5, 0.5f, pattern);
+	    }
+	    FlzCorrupt(sizes[s][0], sizes[s][1]);
+	    FlzOutOfRange(sizes[s][0]);
+	}
+    }
+    catch (CError &err) {
+	fprintf(stderr, "%s\n", err.message);
+	flzFailures++;
+    }
+    remove("flz_round_trip.flz");
+    printf("%s\n", flzFailures ? "FAILED" : "passed");
+    return flzFailures != 0;
+}
+#endif
@@ -1,5 +1,8 @@
 // flowIO.h
 
+#ifndef __FLOWIO_H__
+#define __FLOWIO_H__
+
 // the "official" threshold - if the absolute value of either 
 // flow component is greater, it's considered unknown
 #define UNKNOWN_FLOW_THRESH 1e9
@@ -14,7 +17,36 @@ bool unknown_flow(float *f);
 // read a flow file into 2-band image
 void ReadFlowFile(CFloatImage& img, const char* filename);
 
+// map a flow file into memory; img shares the (copy-on-write) file data
+// and the mapping is released together with the last copy of img
+void ReadFlowFileMapped(CFloatImage& img, const char* filename);
+
+// create a flow file of the given size and map img onto its data;
+// pixels written into img end up in the file, which replaces an existing
+// one only when the last copy of img is released (until then readers,
+// and images still mapping the old file, see the old contents)
+void CreateFlowFileMapped(CFloatImage& img, const char* filename,
+                          int width, int height);
+
 // write a 2-band image into flow file 
-void WriteFlowFile(CFloatImage img, const char* filename);
+// (both ReadFlowFile and WriteFlowFile use the compressed format for
+//  filenames ending in .flz)
+void WriteFlowFile(CFloatImage& img, const char* filename);
+
+// write a flow field given as separate x and y planes, with rows pitch
+// floats apart, into a flow file
+void WriteFlowFile(const float *x, const float *y, int pitch,
+                   int width, int height, const char* filename);
+
+// default quantization of the compressed format, 1/256 pixel
+#define FLZ_FRAC_BITS 8
+
+// write a 2-band image into a compressed ".flz" flow file, components
+// quantized to 1/2^fracBits pixels (unknown flow is kept as such)
+void WriteFlowFileCompressed(CFloatImage& img, const char* filename,
+                             int fracBits = FLZ_FRAC_BITS);
 
+// read a compressed ".flz" flow file into a 2-band image
+void ReadFlowFileCompressed(CFloatImage& img, const char* filename);
 
+#endif
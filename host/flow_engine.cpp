@@ -0,0 +1,65 @@
+/*===============================================================*/
+/*                                                               */
+/*                       flow_engine.cpp                         */
+/*                                                               */
+/*     Reusable optical flow engine with persistent buffers      */
+/*                                                               */
+/*===============================================================*/
+
+#include "flow_engine.h"
+#include "pack_frames.h"
+
+COpticalFlowEngine::COpticalFlowEngine()
+  : m_frames("engine_frames"), m_outputs(new velocity_t[MAX_HEIGHT][MAX_WIDTH]),
+    m_width(MAX_WIDTH), m_height(MAX_HEIGHT), m_nframes(TEMPORAL_5_FRAME), m_channels(1)
+{
+}
+
+COpticalFlowEngine::~COpticalFlowEngine()
+{
+  delete [] m_outputs;
+}
+
+void COpticalFlowEngine::Configure(int width, int height, int nframes, int channels)
+{
+  if (channels < 1 || channels > MAX_CHANNELS)
+    throw CError("COpticalFlowEngine: %d channels is not supported", channels);
+  if (width < 1 || width * channels > MAX_WIDTH || height < 1 || height > MAX_HEIGHT)
+    throw CError("COpticalFlowEngine: illegal frame size");
+  if (nframes != TEMPORAL_5_FRAME && nframes != TEMPORAL_3_FRAME && nframes != TEMPORAL_2_FRAME)
+    throw CError("COpticalFlowEngine: %d frames is not a temporal mode", nframes);
+  m_width = width;
+  m_height = height;
+  m_nframes = nframes;
+  m_channels = channels;
+}
+
+void COpticalFlowEngine::Process(CByteImage frames[], CFloatImage& out)
+{
+  for (int i = 0; i < m_nframes * m_channels; i++)
+  {
+    CShape sh = frames[i].Shape();
+    if (sh.width != m_width || sh.height != m_height || sh.nBands != 1)
+      throw CError("COpticalFlowEngine: frame %d does not match the configured size", i);
+  }
+
+  pack_frames(frames, m_frames, m_nframes, m_channels);
+  optical_flow(m_frames, m_outputs, m_streams, m_height, m_width, 1, m_nframes, m_channels);
+
+  CopyFlow(m_outputs, m_width * m_channels, m_height, out);
+}
+
+void COpticalFlowEngine::CopyFlow(velocity_t outputs[MAX_HEIGHT][MAX_WIDTH], int width, int height,
+                                  CFloatImage& out)
+{
+  out.ReAllocate(CShape(width, height, 2));
+  for (int r = 0; r < height; r++)
+  {
+    float *f = out.Row(r).Data();
+    for (int c = 0; c < width; c++)
+    {
+      f[2*c]     = outputs[r][c].x.to_float();
+      f[2*c + 1] = outputs[r][c].y.to_float();
+    }
+  }
+}
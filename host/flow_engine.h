@@ -0,0 +1,59 @@
+/*===============================================================*/
+/*                                                               */
+/*                        flow_engine.h                          */
+/*                                                               */
+/*     Reusable optical flow engine with persistent buffers      */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __FLOW_ENGINE_H__
+#define __FLOW_ENGINE_H__
+
+#include "typedefs.h"
+#include "imageLib.h"
+#include "../sdsoc/optical_flow.h"
+
+// Runs the optical_flow() operator chain on frame set after frame set.
+// The engine owns the frame stream, the streams between the operators
+// and the velocity buffer for its whole lifetime (the operators keep
+// their line buffers in their own frames), and an output image of the
+// configured size is reused.  In C simulation the calls still allocate:
+// an hls::stream is a std::deque, which allocates and frees its blocks
+// as the words of every frame set pass through.  Engines share no state;
+// each may be driven from its own thread.
+class COpticalFlowEngine
+{
+public:
+  COpticalFlowEngine(void);
+  ~COpticalFlowEngine(void);
+
+  // frame size (at most MAX_WIDTH x MAX_HEIGHT), temporal mode (see
+  // TEMPORAL_*_FRAME) and number of cameras of the following frame sets
+  void Configure(int width, int height, int nframes = TEMPORAL_5_FRAME,
+                 int channels = 1);
+
+  // flow at the middle frame of nframes gray frames (oldest first) into
+  // the 2-band image out, reallocated only if its shape differs; with
+  // several channels, frames holds the frames of each camera in turn and
+  // out their flows side by side (see pack_frames and optical_flow)
+  void Process(CByteImage frames[], CFloatImage& out);
+
+  // the top-left width x height corner of the chain's velocity buffer
+  // into the 2-band image out, reallocated only if its shape differs
+  static void CopyFlow(velocity_t outputs[MAX_HEIGHT][MAX_WIDTH], int width, int height,
+                       CFloatImage& out);
+
+  int Width(void)   { return m_width; }
+  int Height(void)  { return m_height; }
+
+private:
+  COpticalFlowEngine(const COpticalFlowEngine&) = delete;
+  COpticalFlowEngine& operator=(const COpticalFlowEngine&) = delete;
+
+  hls::stream<frames_t> m_frames;           // packed input frames
+  flow_streams_t m_streams;                 // between the operators
+  velocity_t (*m_outputs)[MAX_WIDTH];       // MAX_HEIGHT rows of flow
+  int m_width, m_height, m_nframes, m_channels;
+};
+
+#endif
@@ -0,0 +1,65 @@
+/*===============================================================*/
+/*                                                               */
+/*                       frame_cache.cpp                         */
+/*                                                               */
+/*       Bounded LRU cache of decoded gray input frames          */
+/*                                                               */
+/*===============================================================*/
+
+#include <cstdlib>
+#include <climits>
+#include <utility>
+#include <sys/stat.h>
+
+#include "frame_cache.h"
+
+CFrameCache::CFrameCache(int capacity)
+  : m_capacity(capacity < 1 ? 1 : capacity), m_hits(0), m_misses(0)
+{
+}
+
+CByteImage CFrameCache::Get(const std::string& filename)
+{
+  // canonical path, so different spellings of one file share an entry
+  char resolved[PATH_MAX];
+  std::string key = realpath(filename.c_str(), resolved) ? resolved : filename;
+
+  struct stat st;
+  if (stat(key.c_str(), &st) != 0)
+    throw CError("CFrameCache: could not stat %s", filename.c_str());
+  long long mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  long long size = st.st_size;
+
+  std::map<std::string, std::list<Entry>::iterator>::iterator it = m_index.find(key);
+  if (it != m_index.end())
+  {
+    std::list<Entry>::iterator e = it->second;
+    if (e->mtime == mtime && e->size == size)
+    {
+      // hit: move to the front
+      m_lru.splice(m_lru.begin(), m_lru, e);
+      m_hits++;
+      return e->img;
+    }
+    // stale: the file changed since it was decoded
+    m_lru.erase(e);
+    m_index.erase(it);
+  }
+
+  // miss: decode, insert at the front and evict the least recently used
+  m_misses++;
+  Entry entry;
+  entry.key = key;
+  entry.mtime = mtime;
+  entry.size = size;
+  ReadImageGray(entry.img, filename.c_str());
+  m_lru.push_front(std::move(entry));
+  m_index[key] = m_lru.begin();
+
+  while ((int) m_lru.size() > m_capacity)
+  {
+    m_index.erase(m_lru.back().key);
+    m_lru.pop_back();
+  }
+  return m_lru.front().img;
+}
@@ -0,0 +1,47 @@
+/*===============================================================*/
+/*                                                               */
+/*                        frame_cache.h                          */
+/*                                                               */
+/*       Bounded LRU cache of decoded gray input frames          */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __FRAME_CACHE_H__
+#define __FRAME_CACHE_H__
+
+#include <string>
+#include <list>
+#include <map>
+#include "imageLib.h"
+
+// Consecutive 5-frame windows of a sequence share four frames; the
+// cache keeps the converted gray images so each file is decoded once.
+// Entries are keyed by canonical path and revalidated against the file
+// modification time and size.  Returned images share memory with the
+// cache and must be treated as read-only.
+class CFrameCache
+{
+public:
+  CFrameCache(int capacity = 8);
+
+  CByteImage Get(const std::string& filename);
+
+  int Hits(void)    { return m_hits; }
+  int Misses(void)  { return m_misses; }
+
+private:
+  struct Entry
+  {
+    std::string key;      // canonical path
+    long long mtime;      // modification time (ns)
+    long long size;       // file size (bytes)
+    CByteImage img;       // decoded gray frame
+  };
+
+  std::list<Entry> m_lru;   // most recently used first
+  std::map<std::string, std::list<Entry>::iterator> m_index;
+  int m_capacity;
+  int m_hits, m_misses;
+};
+
+#endif
@@ -2,8 +2,13 @@
 
 // common includes
 
+#ifndef __IMAGELIB_H__
+#define __IMAGELIB_H__
+
 #include "Error.h"
 #include "Image.h"
 #include "ImageIO.h"
 #include "Convert.h"
 #include "flowIO.h"
+
+#endif
@@ -11,40 +11,22 @@
 #include <cstdlib>
 #include <getopt.h>
 #include <string>
+#include <vector>
 #include <time.h>
 #include <sys/time.h>
 #include "utils.h"
 #include "typedefs.h"
 #include "check_result.h"
+#include "frame_cache.h"
+#include "batch.h"
+#include "pyramid.h"
+#include "expand_flow.h"
+#include "pack_frames.h"
+#include "process_pipeline.h"
+#include "video.h"
 #include "../sdsoc/optical_flow.h"
 
 
-void data_gen(
-		hls::stream< frames_t > &Output_1)
-{
-#pragma HLS interface ap_hs port=Output_1
-
-
-	#include "./input_data.h"
-	#pragma HLS ARRAY_PARTITION variable=input_data cyclic factor=2 dim=1
-
-	int i;
-	for (i=0; i<446464; i++)
-	{
-#pragma HLS pipeline II=2
-		frames_t tmp;
-		tmp(63,32) = input_data[i*2];
-		//tmp(63,32) = 0;
-		tmp(31, 0) = input_data[i*2+1];
-
-		Output_1.write(tmp);
-		//Output_1.write(tmp(95,64));
-		//Output_1.write(tmp(127,96));
-	}
-}
-
-
-
 int main(int argc, char ** argv) 
 {
   printf("Optical Flow Application\n");
@@ -52,9 +34,92 @@ int main(int argc, char ** argv)
   // parse command line arguments
   std::string dataPath("");
   std::string outFile("");
+  std::string batchFile("");
+  int levels = 1;
+  int decimate = 1;
+  int nframes = TEMPORAL_5_FRAME;
+  int block = 0;
+  int fracBits = -1;
+  int pitch = -1;
+  std::string processGroups("");
+  int pinCpus = 0;
 
   // for sw and sdsoc versions
-  parse_sdsoc_command_line_args(argc, argv, dataPath, outFile);
+  parse_sdsoc_command_line_args(argc, argv, dataPath, outFile, batchFile, levels, decimate, nframes, block, fracBits, pitch,
+                                processGroups, pinCpus);
+  if ((decimate != 1 && decimate != 2 && decimate != 4) || (decimate > 1 && levels > 1))
+  {
+    printf("decimation must be 1, 2 or 4, and cannot be combined with -l\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if ((nframes != TEMPORAL_5_FRAME && nframes != TEMPORAL_3_FRAME && nframes != TEMPORAL_2_FRAME) ||
+      (nframes != TEMPORAL_5_FRAME && levels > 1))
+  {
+    printf("temporal mode must be 5, 3 or 2 frames, and only 5 works with -l\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if ((block != 0 && block != 8 && block != 16) || (block != 0 && levels > 1))
+  {
+    printf("block size must be 8 or 16, and cannot be combined with -l\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (fracBits > 15 || (fracBits >= 0 && (levels > 1 || decimate > 1 || block)))
+  {
+    printf("fraction bits must be 0-15, and cannot be combined with -l, -d or -a\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (pitch == 0)
+    pitch = MAX_WIDTH;
+  if ((pitch >= 0 && (pitch < MAX_WIDTH || pitch > MAX_PLANAR_PITCH)) ||
+      (pitch >= 0 && (levels > 1 || decimate > 1 || block || fracBits >= 0)))
+  {
+    printf("planar pitch must be 0 or %d-%d, and cannot be combined with -l, -d, -a or -q\n",
+           MAX_WIDTH, MAX_PLANAR_PITCH);
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::vector<int> groups, cpus;
+  for (size_t at = 0; at < processGroups.size(); )
+  {
+    size_t comma = processGroups.find(',', at);
+    if (comma == std::string::npos)
+      comma = processGroups.size();
+    groups.push_back(atoi(processGroups.substr(at, comma - at).c_str()));
+    at = comma + 1;
+  }
+  if (pinCpus)
+    for (size_t i = 0; i < groups.size(); i++)
+      cpus.push_back((int) i);
+  if (!processGroups.empty() && (levels > 1 || decimate > 1 || block || fracBits >= 0 || pitch >= 0))
+  {
+    printf("process groups cannot be combined with -l, -d, -a, -q or -s\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // batch mode: pipelined run over a list of frame sets
+  if (!batchFile.empty())
+  {
+    run_batch(batchFile);
+    return EXIT_SUCCESS;
+  }
+
+  // video mode: flow over every window of a YUV4MPEG2 stream
+  if (dataPath == "-" || (dataPath.size() > 4 && dataPath.compare(dataPath.size() - 4, 4, ".y4m") == 0))
+  {
+    if (levels > 1 || decimate > 1 || block || fracBits >= 0 || pitch >= 0 || !groups.empty())
+    {
+      printf("video input cannot be combined with -l, -d, -a, -q, -s or -m\n");
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    run_video(dataPath, nframes, outFile);
+    return EXIT_SUCCESS;
+  }
 
   // create actual file names according to the datapath
   std::string frame_files[5];
@@ -69,19 +134,16 @@ int main(int argc, char ** argv)
   // read in images and convert to grayscale
   printf("Reading input files ... \n");
 
+  CFrameCache frame_cache;
   CByteImage imgs[5];
   for (int i = 0; i < 5; i++) 
-  {
-    CByteImage tmpImg;
-    ReadImage(tmpImg, frame_files[i].c_str());
-    imgs[i] = ConvertToGray(tmpImg);
-  }
+    imgs[i] = frame_cache.Get(frame_files[i]);
 
   // read in reference flow file
   printf("Reading reference output flow... \n");
 
   CFloatImage refFlow;
-  ReadFlowFile(refFlow, reference_file.c_str());
+  ReadFlowFileMapped(refFlow, reference_file.c_str());
 
   // timers
   struct timeval start, end;
@@ -90,26 +152,71 @@ int main(int argc, char ** argv)
     // input and output buffers
     //static frames_t frames[MAX_HEIGHT][MAX_WIDTH];
     static velocity_t outputs[MAX_HEIGHT][MAX_WIDTH];
+    static block_flow_t blocks[MAX_HEIGHT/MIN_BLOCK][MAX_WIDTH/MIN_BLOCK];
+    static bit32 packed[MAX_HEIGHT][MAX_WIDTH];
+    static vel_pixel_t planar_x[MAX_HEIGHT * MAX_PLANAR_PITCH];
+    static vel_pixel_t planar_y[MAX_HEIGHT * MAX_PLANAR_PITCH];
 
 
     ap_uint<128>  tmpframes;
     static hls::stream< frames_t > frames("test1");
     static hls::stream< ap_uint<32> > flo_out("test2");
 
-    data_gen(frames);
+  if (levels > 1)
+  {
+    // coarse-to-fine over the frames read above
+    COpticalFlowEngine engine;
+    printf("Start! (%d pyramid levels)\n", levels);
+    gettimeofday(&start, NULL);
+    optical_flow_pyramid(engine, imgs, levels, outputs);
+    gettimeofday(&end, NULL);
+  }
+  else if (!groups.empty())
+  {
+    // the operator chain split across processes
+    CProcessPipeline pipeline(groups, MAX_HEIGHT, MAX_WIDTH, nframes, cpus);
+    pack_frames(nframes == TEMPORAL_5_FRAME ? imgs : imgs + 1, frames, nframes);
+    printf("Start! (%d processes)\n", pipeline.Processes());
+
+    gettimeofday(&start, NULL);
+    pipeline.Submit(frames);
+    pipeline.Collect(outputs);
+    gettimeofday(&end, NULL);
+  }
+  else
+  {
+    // every mode runs on the frames read above, with its flow at frame 3:
+    // frames 1-5 (5-frame), 2-4 (3-frame, centred on frame 3) or 2-3
+    // (2-frame, ending at frame 3)
+    pack_frames(nframes == TEMPORAL_5_FRAME ? imgs : imgs + 1, frames, nframes);
     printf("Start!\n");
 
     // run
     gettimeofday(&start, NULL);
-    optical_flow(frames, outputs);
+    if (block)
+      optical_flow_blocks(frames, blocks, block, MAX_HEIGHT, MAX_WIDTH, decimate, nframes);
+    else if (fracBits >= 0)
+      optical_flow_packed(frames, packed, fracBits, MAX_HEIGHT, MAX_WIDTH, 1, nframes);
+    else if (pitch >= 0)
+      optical_flow_planar(frames, planar_x, planar_y, pitch, MAX_HEIGHT, MAX_WIDTH, 1, nframes);
+    else
+      optical_flow(frames, outputs, MAX_HEIGHT, MAX_WIDTH, decimate, nframes);
     printf("Almost there!/n");
     gettimeofday(&end, NULL);
+    if (block)
+      expand_blocks(blocks, outputs, MAX_HEIGHT / decimate, MAX_WIDTH / decimate, block);
+    expand_flow(outputs, MAX_HEIGHT, MAX_WIDTH, decimate);
+  }
 
 
   // check results
   printf("Checking results:\n");
-  printf("The right Average error should be 32.058417\n");
-  check_results(outputs, refFlow, outFile);
+  if (fracBits >= 0)
+    check_results(packed, fracBits, refFlow, outFile);
+  else if (pitch >= 0)
+    check_results(planar_x, planar_y, pitch, refFlow, outFile);
+  else
+    check_results(outputs, refFlow, outFile);
 
   // print time
   long long elapsed = (end.tv_sec - start.tv_sec) * 1000000LL + end.tv_usec - start.tv_usec;   
@@ -0,0 +1,113 @@
+/*===============================================================*/
+/*                                                               */
+/*                       pack_frames.cpp                         */
+/*                                                               */
+/*        Pack five gray frames into the kernel input stream     */
+/*                                                               */
+/*===============================================================*/
+
+#include "pack_frames.h"
+
+static void check_nframes(int nframes)
+{
+  if (nframes != TEMPORAL_5_FRAME && nframes != TEMPORAL_3_FRAME && nframes != TEMPORAL_2_FRAME)
+    throw CError("pack_frames: %d frames per pixel is not supported", nframes);
+}
+
+static void check_size(int width, int height, int channels)
+{
+  if (channels < 1 || channels > MAX_CHANNELS)
+    throw CError("pack_frames: %d channels is not supported", channels);
+  if (width < 1 || width * channels > MAX_WIDTH || height < 1 || height > MAX_HEIGHT)
+    throw CError("pack_frames: frames must be at most MAX_WIDTH x MAX_HEIGHT");
+}
+
+void pack_frames(CByteImage imgs[], hls::stream<frames_t> & Output_1,
+                 int nframes, int channels)
+{
+  check_nframes(nframes);
+  check_size(1, 1, channels);
+
+  CShape sh = imgs[0].Shape();
+  if (sh.nBands != 1)
+    throw CError("pack_frames: frames must be gray");
+  for (int i = 1; i < nframes * channels; i++)
+    if (imgs[i].Shape() != sh)
+      throw CError("pack_frames: frame %d differs in size from frame 0", i);
+
+  const uchar *planes[5 * MAX_CHANNELS];
+  int strides[5 * MAX_CHANNELS];
+  for (int i = 0; i < nframes * channels; i++)
+  {
+    planes[i] = &imgs[i].Pixel(0, 0, 0);
+    strides[i] = imgs[i].RowSize();
+  }
+  pack_frames(planes, strides, sh.width, sh.height, Output_1, nframes, channels);
+}
+
+void pack_frames(const uchar *const planes[], const int strides[],
+                 int width, int height, hls::stream<frames_t> & Output_1,
+                 int nframes, int channels)
+{
+  check_nframes(nframes);
+  check_size(width, height, channels);
+
+  for (int r = 0; r < height; r++)
+    for (int ch = 0; ch < channels; ch++)
+    {
+      const uchar* rows[5];
+      for (int i = 0; i < nframes; i++)
+      {
+        int k = ch * nframes + i;
+        rows[i] = planes[k] + (size_t) r * strides[k];
+      }
+
+      // every row starts a new word, the last one may be partly empty
+      int ppw = pixels_per_word(nframes);
+      for (int c = 0; c < width; c += ppw)
+      {
+        frames_t tmp = 0;
+        for (int p = 0; p < ppw && c + p < width; p++)
+          for (int i = 0; i < nframes; i++)
+          {
+            int lo = 8 * (p * nframes + i);
+            tmp(lo + 7, lo) = rows[i][c + p];
+          }
+        Output_1.write(tmp);
+      }
+    }
+}
+
+CFrameWindow::CFrameWindow(int width, int height, int nframes)
+  : m_width(width), m_height(height), m_nframes(nframes), m_count(0)
+{
+  check_nframes(nframes);
+  check_size(width, height, 1);
+}
+
+void CFrameWindow::Push(const uchar *plane, int stride)
+{
+  if (plane == 0 || stride < m_width)
+    throw CError("CFrameWindow: illegal plane or stride %d", stride);
+
+  // five pointers at most, shifting is cheaper than a ring index
+  if (m_count == m_nframes)
+  {
+    for (int i = 1; i < m_nframes; i++)
+    {
+      m_planes[i-1] = m_planes[i];
+      m_strides[i-1] = m_strides[i];
+    }
+    m_count--;
+  }
+  m_planes[m_count] = plane;
+  m_strides[m_count] = stride;
+  m_count++;
+}
+
+void CFrameWindow::Pack(hls::stream<frames_t> & Output_1)
+{
+  if (!Full())
+    throw CError("CFrameWindow: only %d frames pushed", m_count);
+  pack_frames(m_planes, m_strides, m_width, m_height, Output_1, m_nframes);
+}
@@ -0,0 +1,61 @@
+/*===============================================================*/
+/*                                                               */
+/*                        pack_frames.h                          */
+/*                                                               */
+/*        Pack five gray frames into the kernel input stream     */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __PACK_FRAMES_H__
+#define __PACK_FRAMES_H__
+
+#include "typedefs.h"
+#include "imageLib.h"
+
+// pixels_per_word(nframes) pixels per frames_t word, frame i of pixel p
+// in bits 8*(p*nframes+i)+7 .. 8*(p*nframes+i), oldest frame first; with
+// the default 5 frames that is one word per pixel, frame i in bits
+// 8*i+7 .. 8*i (all frames must have the same size, at most
+// MAX_WIDTH x MAX_HEIGHT)
+//
+// With channels > 1, imgs holds the nframes frames of every channel in
+// turn (channel ch from imgs[ch * nframes]) and row r of each channel
+// follows row r of the previous one, as optical_flow() expects for
+// several cameras (channels * width must not exceed MAX_WIDTH)
+void pack_frames(CByteImage imgs[], hls::stream<frames_t> & Output_1,
+                 int nframes = TEMPORAL_5_FRAME, int channels = 1);
+
+// the same straight from caller-owned width x height gray planes, plane i
+// starting at planes[i] with rows strides[i] bytes apart (no copy is made,
+// every input byte is read once)
+void pack_frames(const uchar *const planes[], const int strides[],
+                 int width, int height, hls::stream<frames_t> & Output_1,
+                 int nframes = TEMPORAL_5_FRAME, int channels = 1);
+
+// The newest nframes planes of a sequence, held by reference.  Push adds
+// a frame and drops the oldest one, so a camera or decoder can hand over
+// each frame once; a plane must stay valid until nframes more have been
+// pushed after it.  Once Full, Planes() and Strides() are in the order
+// pack_frames and optical_flow_sw expect (oldest first).
+class CFrameWindow
+{
+public:
+  CFrameWindow(int width, int height, int nframes = TEMPORAL_5_FRAME);
+
+  void Push(const uchar *plane, int stride);
+  bool Full(void)   { return m_count == m_nframes; }
+  void Pack(hls::stream<frames_t> & Output_1);
+
+  const uchar *const *Planes(void)  { return m_planes; }
+  const int *Strides(void)          { return m_strides; }
+  int Width(void)                   { return m_width; }
+  int Height(void)                  { return m_height; }
+
+private:
+  const uchar *m_planes[5];
+  int m_strides[5];
+  int m_width, m_height, m_nframes;
+  int m_count;      // frames pushed so far, up to m_nframes
+};
+
+#endif
@@ -0,0 +1,295 @@
+/*===============================================================*/
+/*                                                               */
+/*                     process_pipeline.cpp                      */
+/*                                                               */
+/*   Operator chain split across processes over shared memory    */
+/*                                                               */
+/*===============================================================*/
+
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+#include "process_pipeline.h"
+#include "../sdsoc/optical_flow.h"
+#include "../sdsoc/unpack.h"
+#include "../sdsoc/gradient_xy_calc.h"
+#include "../sdsoc/gradient_z_calc.h"
+#include "../sdsoc/gradient_weight_y.h"
+#include "../sdsoc/gradient_weight_x.h"
+#include "../sdsoc/outer_product.h"
+#include "../sdsoc/tensor_weight_y.h"
+#include "../sdsoc/tensor_weight_x.h"
+
+// the streams between the operators, as in optical_flow_stream
+enum
+{
+  FRAME1_A, FRAME2_A, FRAME4_A, FRAME5_A, FRAME3_A, FRAME3_B,
+  GRADIENT_X, GRADIENT_Y, GRADIENT_Z, Y_FILTERED, FILTERED_GRADIENT,
+  OUT_PRODUCT, TENSOR_Y, TENSOR, FLOW, PIPELINE_STREAMS
+};
+
+// 32-bit words per pixel on each stream
+static const int STREAM_WORDS[PIPELINE_STREAMS] =
+  {1, 1, 1, 1, 1, 1, 1, 1, 1, 3, 3, 9, 9, 9, 3};
+
+// the streams each operator reads and writes, -1 terminated (unpack
+// reads the packed frames, and the host reads FLOW)
+static const int OP_INPUTS[PIPELINE_OPERATORS][6] = {
+  {-1},
+  {FRAME3_A, -1},
+  {FRAME1_A, FRAME2_A, FRAME3_B, FRAME4_A, FRAME5_A, -1},
+  {GRADIENT_X, GRADIENT_Y, GRADIENT_Z, -1},
+  {Y_FILTERED, -1},
+  {FILTERED_GRADIENT, -1},
+  {OUT_PRODUCT, -1},
+  {TENSOR_Y, -1},
+  {TENSOR, -1}};
+static const int OP_OUTPUTS[PIPELINE_OPERATORS][7] = {
+  {FRAME1_A, FRAME2_A, FRAME4_A, FRAME5_A, FRAME3_A, FRAME3_B, -1},
+  {GRADIENT_X, GRADIENT_Y, -1},
+  {GRADIENT_Z, -1},
+  {Y_FILTERED, -1},
+  {FILTERED_GRADIENT, -1},
+  {OUT_PRODUCT, -1},
+  {TENSOR_Y, -1},
+  {TENSOR, -1},
+  {FLOW, -1}};
+
+// in place of a frame's word count: no more frames
+const unsigned int PIPELINE_END = 0xffffffff;
+
+// the operator that reads or writes stream s in table ops
+template <int N>
+static int operator_of(const int ops[][N], int s)
+{
+  for (int k = 0; k < PIPELINE_OPERATORS; k++)
+    for (int i = 0; ops[k][i] >= 0; i++)
+      if (ops[k][i] == s)
+        return k;
+  return -1;
+}
+
+static void run_operator(int k, hls::stream<frames_t> & frames, hls::stream< bit32 > s[],
+                         int height, int width, int nframes)
+{
+  switch (k)
+  {
+    case 0:
+      unpack(frames, s[FRAME1_A], s[FRAME2_A], s[FRAME4_A], s[FRAME5_A], s[FRAME3_A], s[FRAME3_B],
+             height, width, 1, nframes, 1);
+      break;
+    case 1:
+      gradient_xy_calc(s[FRAME3_A], s[GRADIENT_X], s[GRADIENT_Y], height, width, 1);
+      break;
+    case 2:
+      gradient_z_calc(s[FRAME1_A], s[FRAME2_A], s[FRAME3_B], s[FRAME4_A], s[FRAME5_A],
+                      s[GRADIENT_Z], height, width, nframes);
+      break;
+    case 3:
+      gradient_weight_y(s[GRADIENT_X], s[GRADIENT_Y], s[GRADIENT_Z], s[Y_FILTERED], height, width, 1);
+      break;
+    case 4:
+      gradient_weight_x(s[Y_FILTERED], s[FILTERED_GRADIENT], height, width);
+      break;
+    case 5:
+      outer_product(s[FILTERED_GRADIENT], s[OUT_PRODUCT], height, width);
+      break;
+    case 6:
+      tensor_weight_y(s[OUT_PRODUCT], s[TENSOR_Y], height, width, 1);
+      break;
+    case 7:
+      tensor_weight_x(s[TENSOR_Y], s[TENSOR], height, width);
+      break;
+    case 8:
+      flow_calc(s[TENSOR], s[FLOW], height, width, 1);
+      break;
+  }
+}
+
+// one frame of a stream onto a ring: the word count, then the words
+template <class T>
+static void send_frame(hls::stream<T> & local, CShmStream<T> & ring)
+{
+  ring.write((T) (unsigned int) local.size());
+  while (!local.empty())
+    ring.write(local.read());
+}
+
+// one frame from a ring into a local stream, false at the end marker
+template <class T>
+static bool receive_frame(CShmStream<T> & ring, hls::stream<T> & local)
+{
+  unsigned long long n = ring.read().to_uint64();
+  if (n == PIPELINE_END)
+    return false;
+  for (unsigned long long i = 0; i < n; i++)
+    local.write(ring.read());
+  return true;
+}
+
+CProcessPipeline::CProcessPipeline(const std::vector<int>& groups,
+                                   int height, int width, int nframes,
+                                   const std::vector<int>& cpus)
+  : m_height(height), m_width(width), m_nframes(nframes),
+    m_input(0), m_output(0), m_rings(PIPELINE_STREAMS, (CShmStream<bit32> *) 0)
+{
+  if (width < 1 || width > MAX_WIDTH || height < 1 || height > MAX_HEIGHT)
+    throw CError("CProcessPipeline: illegal frame size");
+  if (nframes != TEMPORAL_5_FRAME && nframes != TEMPORAL_3_FRAME && nframes != TEMPORAL_2_FRAME)
+    throw CError("CProcessPipeline: %d frames is not a temporal mode", nframes);
+  for (size_t g = 0; g < groups.size(); g++)
+  {
+    if (groups[g] < 1)
+      throw CError("CProcessPipeline: process %d runs no operators", (int) g);
+    for (int i = 0; i < groups[g]; i++)
+      m_groupOf.push_back((int) g);
+  }
+  if ((int) m_groupOf.size() != PIPELINE_OPERATORS)
+    throw CError("CProcessPipeline: the groups must add up to %d operators", PIPELINE_OPERATORS);
+
+  // a frame of words, its count and the end marker fit on every ring
+  long long pixels = (long long) height * width;
+  m_input = new CShmStream<frames_t>(pixels + 2);
+  m_output = new CShmStream<bit32>(STREAM_WORDS[FLOW] * pixels + 2);
+  for (int s = 0; s < FLOW; s++)
+  {
+    int from = m_groupOf[operator_of(OP_OUTPUTS, s)];
+    int to = m_groupOf[operator_of(OP_INPUTS, s)];
+    if (from != to)
+      m_rings[s] = new CShmStream<bit32>(STREAM_WORDS[s] * pixels + 2);
+  }
+
+  fflush(stdout);
+  pid_t parent = getpid();
+  for (size_t g = 0; g < groups.size(); g++)
+  {
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+      // the processes started so far stop at the end marker
+      Stop();
+      throw CError("CProcessPipeline: could not start process %d", (int) g);
+    }
+    if (pid == 0)
+    {
+      // the processes spin until they see the end marker, which only
+      // Stop() sends: die with the parent instead of outliving it (and
+      // check it did not die before this was set up)
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      if (getppid() != parent)
+        _exit(1);
+      if (!cpus.empty())
+      {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[g % cpus.size()], &set);
+        sched_setaffinity(0, sizeof(set), &set);    // only a hint, failure is harmless
+      }
+      RunGroup((int) g);
+      _exit(0);
+    }
+    m_pids.push_back(pid);
+  }
+}
+
+CProcessPipeline::~CProcessPipeline()
+{
+  Stop();
+}
+
+void CProcessPipeline::Stop(void)
+{
+  if (m_input == 0)
+    return;
+
+  // drain uncollected flow while the end marker goes in, the last
+  // process may be waiting for room in the output ring
+  long long left = 0;
+  bool sent = false, ended = m_pids.empty();
+  bit32 word;
+  while (!ended)
+  {
+    if (!sent)
+      sent = m_input->write_nb((frames_t) PIPELINE_END);
+    if (!m_output->read_nb(word))
+    {
+      sched_yield();
+      continue;
+    }
+    if (left > 0)
+      left--;
+    else if (word.to_uint64() == PIPELINE_END)
+      ended = true;
+    else
+      left = word.to_uint64();
+  }
+  for (size_t i = 0; i < m_pids.size(); i++)
+    waitpid(m_pids[i], 0, 0);
+
+  delete m_input;
+  delete m_output;
+  for (int s = 0; s < PIPELINE_STREAMS; s++)
+    delete m_rings[s];
+  m_input = 0;
+}
+
+void CProcessPipeline::RunGroup(int group)
+{
+  hls::stream<frames_t> frames;
+  hls::stream< bit32 > s[PIPELINE_STREAMS];
+
+  for (;;)
+  {
+    // one frame of every input from another process, in stream order
+    bool more = true;
+    if (m_groupOf[0] == group)
+      more = receive_frame(*m_input, frames);
+    for (int i = 0; more && i < PIPELINE_STREAMS; i++)
+      if (m_rings[i] && m_groupOf[operator_of(OP_INPUTS, i)] == group)
+        more = receive_frame(*m_rings[i], s[i]);
+
+    if (more)
+    {
+      for (int k = 0; k < PIPELINE_OPERATORS; k++)
+        if (m_groupOf[k] == group)
+          run_operator(k, frames, s, m_height, m_width, m_nframes);
+    }
+
+    // the outputs for other processes, or the end marker
+    for (int i = 0; i < PIPELINE_STREAMS; i++)
+    {
+      CShmStream<bit32> *ring = (i == FLOW) ? m_output : m_rings[i];
+      if (ring == 0 || m_groupOf[operator_of(OP_OUTPUTS, i)] != group)
+        continue;
+      if (more)
+        send_frame(s[i], *ring);
+      else
+        ring->write((bit32) PIPELINE_END);
+    }
+    if (!more)
+      return;
+  }
+}
+
+void CProcessPipeline::Submit(hls::stream<frames_t> & frames)
+{
+  send_frame(frames, *m_input);
+}
+
+void CProcessPipeline::Collect(velocity_t outputs[MAX_HEIGHT][MAX_WIDTH])
+{
+  hls::stream< bit32 > flow;
+  if (!receive_frame(*m_output, flow) || (int) flow.size() != STREAM_WORDS[FLOW] * m_height * m_width)
+    throw CError("CProcessPipeline: lost the flow of a frame set");
+
+  for (int r = 0; r < m_height; r++)
+    for (int c = 0; c < m_width; c++)
+    {
+      outputs[r][c].x(31, 0) = flow.read();
+      outputs[r][c].y(31, 0) = flow.read();
+      flow.read();    // confidence
+    }
+}
@@ -0,0 +1,72 @@
+/*===============================================================*/
+/*                                                               */
+/*                      process_pipeline.h                       */
+/*                                                               */
+/*   Operator chain split across processes over shared memory    */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __PROCESS_PIPELINE_H__
+#define __PROCESS_PIPELINE_H__
+
+#include <vector>
+#include <sys/types.h>
+#include "typedefs.h"
+#include "shm_stream.h"
+
+// operators of the chain, in order: unpack, gradient_xy_calc,
+// gradient_z_calc, gradient_weight_y, gradient_weight_x, outer_product,
+// tensor_weight_y, tensor_weight_x, flow_calc
+const int PIPELINE_OPERATORS = 9;
+
+// Runs the optical_flow() operator chain as separate processes, the way
+// the operators would be deployed one per device.  groups gives the
+// number of consecutive operators each process runs (so {9} is the
+// whole chain in one process and nine 1s is one process per operator);
+// with cpus, process i is pinned to cpus[i % cpus.size()].
+//
+// Every stream that crosses processes is a CShmStream big enough for a
+// whole frame of it.  A process reads one frame of each of its inputs
+// into local hls::streams, runs its operators and passes their outputs
+// on, so consecutive frame sets move through the processes like the
+// stages of a pipeline.  (Each frame on a ring is preceded by its word
+// count, which lets a process work without knowing what its neighbours
+// run.)
+//
+// Submit and Collect must be called from one thread each, or alternated
+// with at most as many frame sets outstanding as there are processes.
+// The processes are killed when the thread that created the pipeline
+// exits, so they cannot outlive a parent that never stopped them.
+class CProcessPipeline
+{
+public:
+  CProcessPipeline(const std::vector<int>& groups,
+                   int height = MAX_HEIGHT, int width = MAX_WIDTH,
+                   int nframes = TEMPORAL_5_FRAME,
+                   const std::vector<int>& cpus = std::vector<int>());
+  ~CProcessPipeline(void);   // stops the processes, dropping uncollected flow
+
+  // one packed frame set (see pack_frames), the stream is left empty
+  void Submit(hls::stream<frames_t> & frames);
+
+  // the flow of the oldest frame set not collected yet
+  void Collect(velocity_t outputs[MAX_HEIGHT][MAX_WIDTH]);
+
+  int Processes(void)   { return (int) m_pids.size(); }
+
+private:
+  CProcessPipeline(const CProcessPipeline&) = delete;
+  CProcessPipeline& operator=(const CProcessPipeline&) = delete;
+
+  void RunGroup(int group);
+  void Stop(void);
+
+  int m_height, m_width, m_nframes;
+  std::vector<int> m_groupOf;   // process of each operator
+  CShmStream<frames_t> *m_input;
+  CShmStream<bit32> *m_output;
+  std::vector<CShmStream<bit32> *> m_rings;     // per stream, 0 within a process
+  std::vector<pid_t> m_pids;
+};
+
+#endif
@@ -0,0 +1,128 @@
+/*===============================================================*/
+/*                                                               */
+/*                         pyramid.cpp                           */
+/*                                                               */
+/*          Coarse-to-fine optical flow over an image pyramid    */
+/*                                                               */
+/*===============================================================*/
+
+#include <vector>
+
+#include "pyramid.h"
+#include "Convolve.h"
+
+#define PYRAMID_MIN_SIZE      32    // smallest side of the coarsest level
+#define PYRAMID_MAX_RESIDUAL  5.0f  // larger residuals are estimation failures
+
+// resample src at x + t*u(x) with bilinear interpolation
+static void warp_frame(CFloatImage& src, CFloatImage& flow, float t, CByteImage& dst)
+{
+  CShape sh = src.Shape();
+  dst.ReAllocate(sh);
+  float max_x = (float) (sh.width - 1);
+  float max_y = (float) (sh.height - 1);
+
+  for (int r = 0; r < sh.height; r++)
+  {
+    const float *f = flow.Row(r).Data();   // x, y interleaved
+    uchar *out = dst.Row(r).Data();
+    for (int c = 0; c < sh.width; c++)
+    {
+      float x = c + t * f[2*c];
+      float y = r + t * f[2*c + 1];
+      x = x < 0 ? 0 : (x > max_x ? max_x : x);
+      y = y < 0 ? 0 : (y > max_y ? max_y : y);
+
+      int x0 = (int) x;
+      int y0 = (int) y;
+      int x1 = x0 + 1 < sh.width  ? x0 + 1 : x0;
+      int y1 = y0 + 1 < sh.height ? y0 + 1 : y0;
+      float ax = x - x0;
+      float ay = y - y0;
+
+      const float *row0 = src.Row(y0).Data();
+      const float *row1 = src.Row(y1).Data();
+      float top    = row0[x0] + ax * (row0[x1] - row0[x0]);
+      float bottom = row1[x0] + ax * (row1[x1] - row1[x0]);
+      float v = top + ay * (bottom - top) + 0.5f;
+      out[c] = (uchar) (v < 0 ? 0 : (v > 255 ? 255 : v));
+    }
+  }
+}
+
+void optical_flow_pyramid(COpticalFlowEngine& engine, CByteImage imgs[5], int levels,
+                          velocity_t outputs[MAX_HEIGHT][MAX_WIDTH])
+{
+
+  // cap the depth so the coarsest level still fills the windows
+  CShape sh = imgs[0].Shape();
+  int n = 1;
+  for (int w = sh.width, h = sh.height;
+       n < levels && (w + 1) / 2 >= PYRAMID_MIN_SIZE && (h + 1) / 2 >= PYRAMID_MIN_SIZE;
+       w = (w + 1) / 2, h = (h + 1) / 2)
+    n++;
+  levels = n;
+
+  // Gaussian pyramids, level 0 is the full frame
+  std::vector<CFloatImage> pyr[5];
+  for (int i = 0; i < 5; i++)
+  {
+    pyr[i].resize(levels);
+    CopyPixels(imgs[i], pyr[i][0]);
+    for (int l = 1; l < levels; l++)
+      ConvolveSeparable(pyr[i][l-1], pyr[i][l], ConvolveKernel_14641,
+                        ConvolveKernel_14641, 1.0f, 0.0f, 2, 1);
+  }
+
+  CFloatImage flow, residual;
+  for (int l = levels - 1; l >= 0; l--)
+  {
+    CShape lsh = pyr[0][l].Shape();
+    if (l == levels - 1)
+    {
+      flow.ReAllocate(CShape(lsh.width, lsh.height, 2));
+      flow.ClearPixels();
+    }
+    else
+    {
+      // twice the size and twice the displacement; odd sizes crop one pixel
+      CFloatImage up;
+      ConvolveSeparable(flow, up, ConvolveKernel_121, ConvolveKernel_121,
+                        2.0f, 0.0f, 1, 2);
+      flow = up.SubImage(0, 0, lsh.width, lsh.height);
+    }
+
+    // frame k sits k-2 frames away from the middle one
+    CByteImage warped[5];
+    for (int k = 0; k < 5; k++)
+      warp_frame(pyr[k][l], flow, (float) (k - 2), warped[k]);
+
+    engine.Configure(lsh.width, lsh.height);
+    engine.Process(warped, residual);
+
+    for (int r = 0; r < lsh.height; r++)
+    {
+      float *f = flow.Row(r).Data();
+      const float *d = residual.Row(r).Data();
+      for (int c = 0; c < lsh.width; c++)
+      {
+        float dx = d[2*c];
+        float dy = d[2*c + 1];
+        if (dx*dx + dy*dy > PYRAMID_MAX_RESIDUAL * PYRAMID_MAX_RESIDUAL)
+          continue;
+        f[2*c]     += dx;
+        f[2*c + 1] += dy;
+      }
+    }
+  }
+
+  for (int r = 0; r < sh.height; r++)
+  {
+    const float *f = flow.Row(r).Data();
+    for (int c = 0; c < sh.width; c++)
+    {
+      outputs[r][c].x = f[2*c];
+      outputs[r][c].y = f[2*c + 1];
+    }
+  }
+}
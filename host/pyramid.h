@@ -0,0 +1,30 @@
+/*===============================================================*/
+/*                                                               */
+/*                          pyramid.h                            */
+/*                                                               */
+/*          Coarse-to-fine optical flow over an image pyramid    */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include "typedefs.h"
+#include "imageLib.h"
+#include "flow_engine.h"
+
+// Estimate the flow of the five frames coarse to fine.  Each frame is
+// reduced into a Gaussian pyramid of up to `levels` levels (the coarsest
+// level is kept at least PYRAMID_MIN_SIZE pixels on a side).  Starting
+// from zero flow at the coarsest level, every level warps its frames
+// towards the middle one with the flow so far, runs the single-scale
+// operator chain on the warped frames and adds the residual it finds;
+// the flow is then doubled in size and value for the next finer level.
+//
+// The full-resolution result is written to the top-left corner of
+// outputs; levels = 1 is the plain single-scale run.  Every level runs
+// on engine, which is left configured for the finest one.
+void optical_flow_pyramid(COpticalFlowEngine& engine, CByteImage imgs[5], int levels,
+                          velocity_t outputs[MAX_HEIGHT][MAX_WIDTH]);
+
+#endif
@@ -0,0 +1,126 @@
+/*===============================================================*/
+/*                                                               */
+/*                         shm_stream.h                          */
+/*                                                               */
+/*    hls::stream-like ring buffer shared between processes      */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __SHM_STREAM_H__
+#define __SHM_STREAM_H__
+
+#include <atomic>
+#include <new>
+#include <sched.h>
+#include <sys/mman.h>
+#include "imageLib.h"
+
+// A single-producer, single-consumer ring of T in shared anonymous
+// memory.  Create it before fork(); afterwards one process may write and
+// one other process may read, with the read/write/empty/full/size/
+// read_nb/write_nb calls of hls::stream.  read() and write() block by
+// yielding the CPU while the ring is empty or full.
+//
+// The indices live in the shared mapping (lock-free atomics are safe
+// across processes); each side keeps its own copy of the other side's
+// index and only reloads it when the ring looks empty or full, so the
+// two cores touch the shared cache lines about once per lap.
+template <class T>
+class CShmStream
+{
+public:
+  // at least capacity elements, rounded up to a power of two
+  CShmStream(long long capacity)
+  {
+    long long n = 1;
+    while (n < capacity)
+      n <<= 1;
+    m_mask = n - 1;
+    m_bytes = sizeof(Header) + n * sizeof(T);
+    void *base = mmap(0, m_bytes, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+      throw CError("CShmStream: could not map %d MB", (int) (m_bytes >> 20));
+    m_header = new (base) Header;
+    m_header->head = 0;
+    m_header->tail = 0;
+    m_data = (T *) ((char *) base + sizeof(Header));
+    m_head = m_tail = 0;
+    m_seenHead = m_seenTail = 0;
+  }
+
+  ~CShmStream(void)
+  {
+    munmap(m_header, m_bytes);
+  }
+
+  bool write_nb(const T& v)
+  {
+    if (m_tail - m_seenHead > m_mask)
+    {
+      m_seenHead = m_header->head.load(std::memory_order_acquire);
+      if (m_tail - m_seenHead > m_mask)
+        return false;
+    }
+    m_data[m_tail & m_mask] = v;
+    m_tail++;
+    m_header->tail.store(m_tail, std::memory_order_release);
+    return true;
+  }
+
+  bool read_nb(T& v)
+  {
+    if (m_head == m_seenTail)
+    {
+      m_seenTail = m_header->tail.load(std::memory_order_acquire);
+      if (m_head == m_seenTail)
+        return false;
+    }
+    v = m_data[m_head & m_mask];
+    m_head++;
+    m_header->head.store(m_head, std::memory_order_release);
+    return true;
+  }
+
+  void write(const T& v)
+  {
+    while (!write_nb(v))
+      sched_yield();
+  }
+
+  T read(void)
+  {
+    T v;
+    while (!read_nb(v))
+      sched_yield();
+    return v;
+  }
+
+  // as seen by the calling side
+  long long size(void)
+  {
+    return m_header->tail.load(std::memory_order_acquire) -
+           m_header->head.load(std::memory_order_acquire);
+  }
+  bool empty(void)  { return size() == 0; }
+  bool full(void)   { return size() > (long long) m_mask; }
+
+private:
+  CShmStream(const CShmStream&) = delete;
+  CShmStream& operator=(const CShmStream&) = delete;
+
+  struct Header
+  {
+    alignas(64) std::atomic<unsigned long long> head;   // next element to read
+    alignas(64) std::atomic<unsigned long long> tail;   // next element to write
+  };
+
+  Header *m_header;
+  T *m_data;
+  unsigned long long m_mask;
+  size_t m_bytes;
+  unsigned long long m_head, m_seenTail;    // reader side
+  unsigned long long m_tail, m_seenHead;    // writer side
+};
+
+#endif
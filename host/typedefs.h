@@ -11,6 +11,17 @@
 //#include "ap_fixed.h"
 const int MAX_HEIGHT = 436;
 const int MAX_WIDTH = 1024;
+
+// temporal gradient modes, by the number of frames streamed per pixel
+const int TEMPORAL_5_FRAME = 5;   // (f1 - 8f2 + 8f4 - f5)/12 at f3, two frames behind
+const int TEMPORAL_3_FRAME = 3;   // (f3 - f1)/2 at f2, one frame behind
+const int TEMPORAL_2_FRAME = 2;   // f2 - f1 at the newest frame
+
+// pixels per 64-bit frames_t word: 8 bits per frame, 5x1, 3x2 or 2x4
+inline int pixels_per_word(int nframes)
+{
+  return (nframes == TEMPORAL_2_FRAME) ? 4 : ((nframes == TEMPORAL_3_FRAME) ? 2 : 1);
+}
 #include "hls_stream.h"
 #define SDSOC
 #include <hls_video.h>
@@ -22,6 +33,9 @@ const int MAX_WIDTH = 1024;
 	typedef ap_fixed<48,27> outer_pixel_t;
 	typedef ap_fixed<96,56> calc_pixel_t;
 	typedef ap_fixed<32,13> vel_pixel_t;
+	// structure tensor determinant: [0, 2^-12) saturating, LSB 2^-44
+	// (below the resolution the 48-bit tensors give it anyway)
+	typedef ap_ufixed<32,-12,AP_TRN,AP_SAT> conf_pixel_t;
 	//typedef ap_fixed<16,8> input_t;
         //typedef ap_fixed<32,13> pixel_t;
         //typedef float outer_pixel_t;
@@ -55,6 +69,37 @@ typedef struct{
     vel_pixel_t y;
 }velocity_t;
 
+// one pixel of the valid-only flow output
+typedef struct{
+    int index;          // r * width + c in the flow raster
+    velocity_t flow;
+}flow_record_t;
+
+// the block-aggregated output, blocks of 8x8 or 16x16 flow pixels
+const int MIN_BLOCK = 8;
+typedef struct{
+    velocity_t flow;    // mean of the vectors with a nonzero confidence
+    conf_pixel_t conf;  // mean confidence
+}block_flow_t;
+
+// the packed output: x in bits 15..0 and y in bits 31..16 of a word,
+// signed 16-bit with this many fraction bits unless chosen otherwise
+const int PACKED_FRAC_BITS = 8;
+
+// the planar output: separate x and y planes whose rows may be padded,
+// by up to 64 vectors, to a row pitch of at most this
+const int MAX_PLANAR_PITCH = MAX_WIDTH + 64;
+
+// independent cameras one operator chain can interleave; they share the
+// line buffers, so channels * width must also fit in MAX_WIDTH
+const int MAX_CHANNELS = 8;
+
+// a point to track, in pixels of the frame
+typedef struct{
+    int x;
+    int y;
+}feature_t;
+
 #ifndef SW
   #include "ap_int.h"
   // for data packing
@@ -17,8 +17,17 @@ void print_usage(char* filename)
 {
     printf("usage: %s <options>\n", filename);
     printf("  -f [kernel file]\n");
-    printf("  -p [path to data]\n");
+    printf("  -p [path to data, or a .y4m video (- for stdin)]\n");
     printf("  -o [path to output]\n");
+    printf("  -b [frame set list for batch mode]\n");
+    printf("  -l [pyramid levels, coarse-to-fine mode if > 1]\n");
+    printf("  -d [decimation 1, 2 or 4 for a reduced-resolution preview]\n");
+    printf("  -t [frames per temporal gradient: 5, 3 or 2]\n");
+    printf("  -a [block size 8 or 16 for one vector per block]\n");
+    printf("  -q [fraction bits 0-15 for the packed 16-bit output]\n");
+    printf("  -s [row pitch of the planar x/y output, 0 for the frame width]\n");
+    printf("  -m [operators per process, e.g. 1,1,1,1,1,1,1,1,1 or 3,3,3]\n");
+    printf("  -k (with -m, pin process i to cpu i)\n");
 }
 
 void parse_sdaccel_command_line_args(
@@ -57,12 +66,21 @@ void parse_sdsoc_command_line_args(
     int argc,
     char** argv,
     std::string& dataPath,
-    std::string& outFile  ) 
+    std::string& outFile,
+    std::string& batchFile,
+    int& levels,
+    int& decimate,
+    int& nframes,
+    int& block,
+    int& fracBits,
+    int& pitch,
+    std::string& processGroups,
+    int& pinCpus  ) 
 {
 
   int c = 0;
 
-  while ((c = getopt(argc, argv, "p:o:")) != -1) 
+  while ((c = getopt(argc, argv, "p:o:b:l:d:t:a:q:s:m:k")) != -1) 
   {
     switch (c) 
     {
@@ -72,6 +90,33 @@ void parse_sdsoc_command_line_args(
       case 'o':
         outFile = optarg;
         break;
+      case 'b':
+        batchFile = optarg;
+        break;
+      case 'l':
+        levels = atoi(optarg);
+        break;
+      case 'd':
+        decimate = atoi(optarg);
+        break;
+      case 't':
+        nframes = atoi(optarg);
+        break;
+      case 'a':
+        block = atoi(optarg);
+        break;
+      case 'q':
+        fracBits = atoi(optarg);
+        break;
+      case 's':
+        pitch = atoi(optarg);
+        break;
+      case 'm':
+        processGroups = optarg;
+        break;
+      case 'k':
+        pinCpus = 1;
+        break;
      default:
       {
         print_usage(argv[0]);
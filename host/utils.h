@@ -19,4 +19,13 @@ void parse_sdsoc_command_line_args(
     int argc,
     char** argv,
     std::string& dataPath,
-    std::string& outFile  ); 
+    std::string& outFile,
+    std::string& batchFile,
+    int& levels,
+    int& decimate,
+    int& nframes,
+    int& block,
+    int& fracBits,
+    int& pitch,
+    std::string& processGroups,
+    int& pinCpus  ); 
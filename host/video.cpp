@@ -0,0 +1,62 @@
+/*===============================================================*/
+/*                                                               */
+/*                          video.cpp                            */
+/*                                                               */
+/*        Continuous flow over a YUV4MPEG2 video stream          */
+/*                                                               */
+/*===============================================================*/
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "typedefs.h"
+#include "video.h"
+#include "flow_engine.h"
+
+static long long now_us()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+void run_video(const std::string& videoPath, int nframes, const std::string& outFile)
+{
+  CLumaStream video;
+  video.Open(videoPath.c_str());
+
+  COpticalFlowEngine engine;
+  engine.Configure(video.Width(), video.Height(), nframes);
+  printf("Video %s: %d x %d\n", videoPath.c_str(), video.Width(), video.Height());
+
+  // the newest nframes frames, oldest first (views of the file when it
+  // is mapped, so sliding the window copies no pixels)
+  std::vector<CByteImage> window;
+  CFloatImage flow;
+  CByteImage frame;
+  int windows = 0;
+  long long compute_us = 0;
+  while (video.ReadFrame(frame))
+  {
+    if ((int) window.size() == nframes)
+      window.erase(window.begin());
+    window.push_back(frame);
+    if ((int) window.size() < nframes)
+      continue;
+
+    long long start = now_us();
+    engine.Process(&window[0], flow);
+    compute_us += now_us() - start;
+    windows++;
+  }
+
+  if (windows == 0)
+    throw CError("run_video: %s has fewer than %d frames", videoPath.c_str(), nframes);
+  printf("%d frame sets, %lld us compute (%.1f sets/s)\n", windows, compute_us,
+         windows * 1e6 / compute_us);
+
+  if (!outFile.empty())
+    WriteFlowFile(flow, outFile.c_str());
+}
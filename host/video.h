@@ -0,0 +1,21 @@
+/*===============================================================*/
+/*                                                               */
+/*                           video.h                             */
+/*                                                               */
+/*        Continuous flow over a YUV4MPEG2 video stream          */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __VIDEO_H__
+#define __VIDEO_H__
+
+#include <string>
+
+// Run the operator chain over every window of nframes consecutive frames
+// of a YUV4MPEG2 video (a .y4m file, or "-" for stdin), reading only the
+// luma planes through CLumaStream.  Frames of a mapped file are used in
+// place.  There is no reference flow to check against; the flow of the
+// last window is written to outFile if one is given.
+void run_video(const std::string& videoPath, int nframes, const std::string& outFile);
+
+#endif
@@ -3,20 +3,23 @@
 
 // average gradient in the x direction
 void gradient_weight_x(hls::stream< bit32> & Input_1,
-		hls::stream< bit32> & Output_1)
+		hls::stream< bit32> & Output_1,
+		int height, int width)
 {
   hls::Window<1,7,gradient_t> buf;
   bit32 out1_tmp;
 
   const pixel_t GRAD_FILTER[] = {0.0755, 0.133, 0.1869, 0.2903, 0.1869, 0.133, 0.0755};
-  GRAD_WEIGHT_X_OUTER: for(int r=0; r<MAX_HEIGHT; r++)
+  GRAD_WEIGHT_X_OUTER: for(int r=0; r<height; r++)
   {
-    GRAD_WEIGHT_X_INNER: for(int c=0; c<MAX_WIDTH+3; c++)
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    GRAD_WEIGHT_X_INNER: for(int c=0; c<width+3; c++)
     {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
       #pragma HLS pipeline II=1
       buf.shift_pixels_left();
       gradient_t tmp;
-      if(c<MAX_WIDTH)
+      if(c<width)
       {
         //tmp = y_filt[r][c];
         tmp.x(31, 0) = Input_1.read();
@@ -35,7 +38,7 @@ void gradient_weight_x(hls::stream< bit32> & Input_1,
       acc.x = 0;
       acc.y = 0;
       acc.z = 0;
-      if(c >= 6 && c<MAX_WIDTH)
+      if(c >= 6 && c<width)
       {
         GRAD_WEIGHT_X_ACC: for(int i=0; i<7; i++)
         {
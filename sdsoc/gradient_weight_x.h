@@ -1,3 +1,4 @@
 
 void gradient_weight_x(hls::stream< bit32> & Input_1,
-		hls::stream< bit32> & Output_1);
+		hls::stream< bit32> & Output_1,
+		int height, int width);
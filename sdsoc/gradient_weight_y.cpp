@@ -6,71 +6,79 @@ void gradient_weight_y(
 		hls::stream< bit32> & Input_1,
 		hls::stream< bit32> & Input_2,
 		hls::stream< bit32> & Input_3,
-		hls::stream< bit32> & Output_1)
+		hls::stream< bit32> & Output_1,
+		int height, int width, int channels)
 {
   hls::LineBuffer<7,MAX_WIDTH,gradient_t> buf;
 
   bit32 out1_tmp, out2_tmp, out3_tmp;
 
   const pixel_t GRAD_FILTER[] = {0.0755, 0.133, 0.1869, 0.2903, 0.1869, 0.133, 0.0755};
-  GRAD_WEIGHT_Y_OUTER: for(int r=0; r<MAX_HEIGHT+3; r++)
+  GRAD_WEIGHT_Y_OUTER: for(int r=0; r<height+3; r++)
   {
-    GRAD_WEIGHT_Y_INNER: for(int c=0; c<MAX_WIDTH; c++)
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    GRAD_WEIGHT_Y_CHANNEL: for(int ch=0; ch<channels; ch++)
     {
-      #pragma HLS pipeline II=1
-      #pragma HLS dependence variable=buf inter false
-
-      if(r<MAX_HEIGHT)
-      {
-        buf.shift_pixels_up(c);
-        gradient_t tmp;
-        tmp.x(31, 0) = Input_1.read();
-        tmp.y(31, 0) = Input_2.read();
-        tmp.z(31, 0) = Input_3.read();
-        buf.insert_bottom_row(tmp,c);
-      }
-      else
+      #pragma HLS loop_tripcount max=MAX_CHANNELS
+      int base = ch * width;    // this channel's line buffer columns
+      GRAD_WEIGHT_Y_INNER: for(int c=0; c<width; c++)
       {
-        buf.shift_pixels_up(c);
-        gradient_t tmp;
-        tmp.x = 0;
-        tmp.y = 0;
-        tmp.z = 0;
-        buf.insert_bottom_row(tmp,c);
-      }
+        #pragma HLS loop_tripcount max=MAX_WIDTH
+        #pragma HLS pipeline II=1
+        #pragma HLS dependence variable=buf inter false
 
-      gradient_t acc;
-      acc.x = 0;
-      acc.y = 0;
-      acc.z = 0;
-      if(r >= 6 && r<MAX_HEIGHT)
-      {
-        GRAD_WEIGHT_Y_ACC: for(int i=0; i<7; i++)
+        if(r<height)
+        {
+          buf.shift_pixels_up(base + c);
+          gradient_t tmp;
+          tmp.x(31, 0) = Input_1.read();
+          tmp.y(31, 0) = Input_2.read();
+          tmp.z(31, 0) = Input_3.read();
+          buf.insert_bottom_row(tmp,base + c);
+        }
+        else
         {
-          acc.x += buf.getval(i,c).x*GRAD_FILTER[i];
-          acc.y += buf.getval(i,c).y*GRAD_FILTER[i];
-          acc.z += buf.getval(i,c).z*GRAD_FILTER[i];
+          buf.shift_pixels_up(base + c);
+          gradient_t tmp;
+          tmp.x = 0;
+          tmp.y = 0;
+          tmp.z = 0;
+          buf.insert_bottom_row(tmp,base + c);
         }
-        out1_tmp(31, 0) = acc.x(31, 0);
-        Output_1.write(out1_tmp);
-        out1_tmp(31, 0) = acc.y(31, 0);
-        Output_1.write(out1_tmp);
-        out1_tmp(31, 0) = acc.z(31, 0);
-        Output_1.write(out1_tmp);
 
-        //filt_grad[r-3][c] = acc;
+        gradient_t acc;
+        acc.x = 0;
+        acc.y = 0;
+        acc.z = 0;
+        if(r >= 6 && r<height)
+        {
+          GRAD_WEIGHT_Y_ACC: for(int i=0; i<7; i++)
+          {
+            acc.x += buf.getval(i,base + c).x*GRAD_FILTER[i];
+            acc.y += buf.getval(i,base + c).y*GRAD_FILTER[i];
+            acc.z += buf.getval(i,base + c).z*GRAD_FILTER[i];
+          }
+          out1_tmp(31, 0) = acc.x(31, 0);
+          Output_1.write(out1_tmp);
+          out1_tmp(31, 0) = acc.y(31, 0);
+          Output_1.write(out1_tmp);
+          out1_tmp(31, 0) = acc.z(31, 0);
+          Output_1.write(out1_tmp);
 
-      }
-      else if(r>=3)
-      {
-        //filt_grad[r-3][c] = acc;
-        out1_tmp(31, 0) = acc.x(31, 0);
-        Output_1.write(out1_tmp);
-        out1_tmp(31, 0) = acc.y(31, 0);
-        Output_1.write(out1_tmp);
-        out1_tmp(31, 0) = acc.z(31, 0);
-        Output_1.write(out1_tmp);
+          //filt_grad[r-3][c] = acc;
 
+        }
+        else if(r>=3)
+        {
+          //filt_grad[r-3][c] = acc;
+          out1_tmp(31, 0) = acc.x(31, 0);
+          Output_1.write(out1_tmp);
+          out1_tmp(31, 0) = acc.y(31, 0);
+          Output_1.write(out1_tmp);
+          out1_tmp(31, 0) = acc.z(31, 0);
+          Output_1.write(out1_tmp);
+
+        }
       }
     }
   }
@@ -2,4 +2,5 @@ void gradient_weight_y(
 		hls::stream< bit32> & Input_1,
 		hls::stream< bit32> & Input_2,
 		hls::stream< bit32> & Input_3,
-		hls::stream< bit32> & Output_1);
+		hls::stream< bit32> & Output_1,
+		int height, int width, int channels);
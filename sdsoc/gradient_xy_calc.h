@@ -1,4 +1,5 @@
 void gradient_xy_calc(
 		hls::stream< bit32 > & Input_1,
 		hls::stream< bit32 > & Output_1,
-		hls::stream< bit32 > & Output_2);
+		hls::stream< bit32 > & Output_2,
+		int height, int width, int channels);
@@ -8,7 +8,8 @@ void gradient_z_calc(
 	hls::stream< bit32 > & Input_3,
 	hls::stream< bit32 > & Input_4,
 	hls::stream< bit32 > & Input_5,
-	hls::stream< bit32 > & Output_1
+	hls::stream< bit32 > & Output_1,
+	int height, int width, int nframes
 	)
 {
 
@@ -17,11 +18,16 @@ void gradient_z_calc(
 	pixel_t gradient_z;
 	bit32 out_tmp;
 
-  const int GRAD_WEIGHTS[] =  {1,-8,0,8,-1};
-  GRAD_Z_OUTER: for(int r=0; r<MAX_HEIGHT; r++)
+  // taps over the five frame slots filled by unpack, per temporal mode
+  const int GRAD_WEIGHTS[3][5] = {{1,-8,0,8,-1}, {0,-1,0,1,0}, {0,-1,1,0,0}};
+  const int GRAD_DIVISOR[3] = {12, 2, 1};
+  int mode = (nframes == TEMPORAL_3_FRAME) ? 1 : ((nframes == TEMPORAL_2_FRAME) ? 2 : 0);
+  GRAD_Z_OUTER: for(int r=0; r<height; r++)
   {
-    GRAD_Z_INNER: for(int c=0; c<MAX_WIDTH; c++)
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    GRAD_Z_INNER: for(int c=0; c<width; c++)
     {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
       #pragma HLS pipeline II=1
       in1_tmp = Input_1.read();
       frame1(16, 0) = in1_tmp(16, 0);
@@ -33,11 +39,11 @@ void gradient_z_calc(
       frame4(16, 0) = in4_tmp(16, 0);
       in5_tmp = Input_5.read();
       frame5(16, 0) = in5_tmp(16, 0);
-      gradient_z =((pixel_t)(frame1*GRAD_WEIGHTS[0]
-                        + frame2*GRAD_WEIGHTS[1]
-                        + frame3*GRAD_WEIGHTS[2]
-                        + frame4*GRAD_WEIGHTS[3]
-                        + frame5*GRAD_WEIGHTS[4]))/12;
+      gradient_z =((pixel_t)(frame1*GRAD_WEIGHTS[mode][0]
+                        + frame2*GRAD_WEIGHTS[mode][1]
+                        + frame3*GRAD_WEIGHTS[mode][2]
+                        + frame4*GRAD_WEIGHTS[mode][3]
+                        + frame5*GRAD_WEIGHTS[mode][4]))/GRAD_DIVISOR[mode];
       out_tmp(31, 0) = gradient_z(31, 0);
       Output_1.write(out_tmp);
     }
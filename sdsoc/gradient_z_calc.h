@@ -5,5 +5,6 @@ void gradient_z_calc(
 	hls::stream< bit32 > & Input_3,
 	hls::stream< bit32 > & Input_4,
 	hls::stream< bit32 > & Input_5,
-	hls::stream< bit32 > & Output_1
+	hls::stream< bit32 > & Output_1,
+	int height, int width, int nframes
 	);
@@ -33,86 +33,370 @@ const int default_depth = MAX_WIDTH;
 
 
 // compute output flow
+// three words per pixel: the two velocity components and the confidence
 void flow_calc(hls::stream< bit32> & Input_1,
-               velocity_t outputs[MAX_HEIGHT][MAX_WIDTH])
+               hls::stream< bit32> & Output_1,
+               int height, int width, int decimate, int channels)
 {
-  static outer_pixel_t buf[2];
-  bit32 in_tmp;
+  // the solved vector, zero at the border and where the solve is singular
+  outer_pixel_t buf[2];
+  bit32 in_tmp, out_tmp;
 
-  FLOW_OUTER: for(int r=0; r<MAX_HEIGHT; r++)
+  FLOW_OUTER: for(int r=0; r<height; r++)
   {
-    FLOW_INNER: for(int c=0; c<MAX_WIDTH; c++)
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    FLOW_CHANNEL: for(int ch=0; ch<channels; ch++)
     {
-      #pragma HLS pipeline II=1
-      tensor_t tmp_tensor;
-      in_tmp = Input_1.read();
-      tmp_tensor.val[0](31,  0) = in_tmp(31,  0);
-      in_tmp = Input_1.read();
-      tmp_tensor.val[0](47, 32) = in_tmp(15,  0);
-      tmp_tensor.val[1](15,  0) = in_tmp(31, 16);
-      in_tmp = Input_1.read();
-      tmp_tensor.val[1](47, 16) = in_tmp(31,  0);
-
-      in_tmp = Input_1.read();
-      tmp_tensor.val[2](31,  0) = in_tmp(31,  0);
-      in_tmp = Input_1.read();
-      tmp_tensor.val[2](47, 32) = in_tmp(15,  0);
-      tmp_tensor.val[3](15,  0) = in_tmp(31, 16);
-      in_tmp = Input_1.read();
-      tmp_tensor.val[3](47, 16) = in_tmp(31,  0);
-
-
-      in_tmp = Input_1.read();
-      tmp_tensor.val[4](31,  0) = in_tmp(31,  0);
-      in_tmp = Input_1.read();
-      tmp_tensor.val[4](47, 32) = in_tmp(15,  0);
-      tmp_tensor.val[5](15,  0) = in_tmp(31, 16);
-      in_tmp = Input_1.read();
-      tmp_tensor.val[5](47, 16) = in_tmp(31,  0);
-
-
-      if(r>=2 && r<MAX_HEIGHT-2 && c>=2 && c<MAX_WIDTH-2)
+      #pragma HLS loop_tripcount max=MAX_CHANNELS
+      FLOW_INNER: for(int c=0; c<width; c++)
       {
-	      calc_pixel_t t1 = (calc_pixel_t) tmp_tensor.val[0];
-	      calc_pixel_t t2 = (calc_pixel_t) tmp_tensor.val[1];
-	      calc_pixel_t t3 = (calc_pixel_t) tmp_tensor.val[2];
-	      calc_pixel_t t4 = (calc_pixel_t) tmp_tensor.val[3];
-	      calc_pixel_t t5 = (calc_pixel_t) tmp_tensor.val[4];
-	      calc_pixel_t t6 = (calc_pixel_t) tmp_tensor.val[5];
-
-        calc_pixel_t denom = t1*t2-t4*t4;
-	      calc_pixel_t numer0 = t6*t4-t5*t2;
-	      calc_pixel_t numer1 = t5*t4-t6*t1;
-
-	      if(denom != 0)
+        #pragma HLS loop_tripcount max=MAX_WIDTH
+        #pragma HLS pipeline II=1
+        tensor_t tmp_tensor;
+        conf_pixel_t conf = 0;
+        in_tmp = Input_1.read();
+        tmp_tensor.val[0](31,  0) = in_tmp(31,  0);
+        in_tmp = Input_1.read();
+        tmp_tensor.val[0](47, 32) = in_tmp(15,  0);
+        tmp_tensor.val[1](15,  0) = in_tmp(31, 16);
+        in_tmp = Input_1.read();
+        tmp_tensor.val[1](47, 16) = in_tmp(31,  0);
+
+        in_tmp = Input_1.read();
+        tmp_tensor.val[2](31,  0) = in_tmp(31,  0);
+        in_tmp = Input_1.read();
+        tmp_tensor.val[2](47, 32) = in_tmp(15,  0);
+        tmp_tensor.val[3](15,  0) = in_tmp(31, 16);
+        in_tmp = Input_1.read();
+        tmp_tensor.val[3](47, 16) = in_tmp(31,  0);
+
+
+        in_tmp = Input_1.read();
+        tmp_tensor.val[4](31,  0) = in_tmp(31,  0);
+        in_tmp = Input_1.read();
+        tmp_tensor.val[4](47, 32) = in_tmp(15,  0);
+        tmp_tensor.val[5](15,  0) = in_tmp(31, 16);
+        in_tmp = Input_1.read();
+        tmp_tensor.val[5](47, 16) = in_tmp(31,  0);
+
+
+        if(r>=2 && r<height-2 && c>=2 && c<width-2)
+        {
+	        calc_pixel_t t1 = (calc_pixel_t) tmp_tensor.val[0];
+	        calc_pixel_t t2 = (calc_pixel_t) tmp_tensor.val[1];
+	        calc_pixel_t t3 = (calc_pixel_t) tmp_tensor.val[2];
+	        calc_pixel_t t4 = (calc_pixel_t) tmp_tensor.val[3];
+	        calc_pixel_t t5 = (calc_pixel_t) tmp_tensor.val[4];
+	        calc_pixel_t t6 = (calc_pixel_t) tmp_tensor.val[5];
+
+          calc_pixel_t denom = t1*t2-t4*t4;
+	        calc_pixel_t numer0 = t6*t4-t5*t2;
+	        calc_pixel_t numer1 = t5*t4-t6*t1;
+
+	        // the determinant, negative only through rounding
+	        if(denom > 0)
+	          conf = (conf_pixel_t) denom;
+
+	        if(denom != 0)
+          {
+            buf[0] = numer0 / denom;
+            buf[1] = numer1 / denom;
+	        }
+	        else
+	        {
+		        buf[0] = 0;
+		        buf[1] = 0;
+	        }
+        }
+        else
         {
-          buf[0] = numer0 / denom;
-          buf[1] = numer1 / denom;
-	      }
-	      else
-	      {
-		      buf[0] = 0;
-		      buf[1] = 0;
-	      }
+          buf[0] = buf[1] = 0;
+        }
+
+        // back to full-resolution pixels
+        vel_pixel_t vx = (vel_pixel_t)(buf[0] * decimate);
+        vel_pixel_t vy = (vel_pixel_t)(buf[1] * decimate);
+        out_tmp(31, 0) = vx(31, 0);
+        Output_1.write(out_tmp);
+        out_tmp(31, 0) = vy(31, 0);
+        Output_1.write(out_tmp);
+        out_tmp(31, 0) = conf(31, 0);
+        Output_1.write(out_tmp);
       }
-      else
+    }
+  }
+}
+
+// flow_calc output to the velocity array
+void flow_write(hls::stream< bit32> & Input_1,
+                velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                int height, int width)
+{
+  FLOW_WRITE_OUTER: for(int r=0; r<height; r++)
+  {
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    FLOW_WRITE_INNER: for(int c=0; c<width; c++)
+    {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
+      #pragma HLS pipeline II=3
+      outputs[r][c].x(31, 0) = Input_1.read();
+      outputs[r][c].y(31, 0) = Input_1.read();
+      Input_1.read();
+    }
+  }
+}
+
+// flow_calc output to the velocity and confidence arrays
+void flow_write_confidence(hls::stream< bit32> & Input_1,
+                           velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                           conf_pixel_t confidence[MAX_HEIGHT][MAX_WIDTH],
+                           int height, int width)
+{
+  FLOW_CONF_OUTER: for(int r=0; r<height; r++)
+  {
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    FLOW_CONF_INNER: for(int c=0; c<width; c++)
+    {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
+      #pragma HLS pipeline II=3
+      outputs[r][c].x(31, 0) = Input_1.read();
+      outputs[r][c].y(31, 0) = Input_1.read();
+      confidence[r][c](31, 0) = Input_1.read();
+    }
+  }
+}
+
+// flow_calc output to separate x and y planes with rows pitch apart
+void flow_write_planar(hls::stream< bit32> & Input_1,
+                       vel_pixel_t outputs_x[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                       vel_pixel_t outputs_y[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                       int pitch, int height, int width)
+{
+  if (pitch < width)
+    pitch = width;
+  if (pitch > MAX_PLANAR_PITCH)
+    pitch = MAX_PLANAR_PITCH;
+
+  FLOW_PLANAR_OUTER: for(int r=0; r<height; r++)
+  {
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    FLOW_PLANAR_INNER: for(int c=0; c<width; c++)
+    {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
+      #pragma HLS pipeline II=3
+      int i = r * pitch + c;
+      outputs_x[i](31, 0) = Input_1.read();
+      outputs_y[i](31, 0) = Input_1.read();
+      Input_1.read();
+    }
+  }
+}
+
+// flow_calc output as two signed 16-bit components per word with
+// frac_bits (0..15) fraction bits, rounded to nearest and saturated
+void flow_write_packed(hls::stream< bit32> & Input_1,
+                       bit32 outputs[MAX_HEIGHT][MAX_WIDTH],
+                       int frac_bits, int height, int width)
+{
+  if (frac_bits < 0)
+    frac_bits = 0;
+  if (frac_bits > 15)
+    frac_bits = 15;
+
+  FLOW_PACKED_OUTER: for(int r=0; r<height; r++)
+  {
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    FLOW_PACKED_INNER: for(int c=0; c<width; c++)
+    {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
+      #pragma HLS pipeline II=3
+      vel_pixel_t vx, vy;
+      vx(31, 0) = Input_1.read();
+      vy(31, 0) = Input_1.read();
+      Input_1.read();
+
+      // |v| < 2^12, so the scaled value fits 28 integer bits; the
+      // conversion to a 16-bit integer does the rounding and saturation
+      ap_fixed<64,32> sx = ((ap_fixed<64,32>) vx) << frac_bits;
+      ap_fixed<64,32> sy = ((ap_fixed<64,32>) vy) << frac_bits;
+      ap_fixed<16,16,AP_RND,AP_SAT> qx = sx;
+      ap_fixed<16,16,AP_RND,AP_SAT> qy = sy;
+      bit32 out_tmp;
+      out_tmp(15,  0) = qx(15, 0);
+      out_tmp(31, 16) = qy(15, 0);
+      outputs[r][c] = out_tmp;
+    }
+  }
+}
+
+// flow_calc output as (index, velocity) records of the pixels whose
+// confidence exceeds threshold, in raster order
+void flow_write_sparse(hls::stream< bit32> & Input_1,
+                       flow_record_t records[MAX_HEIGHT * MAX_WIDTH],
+                       int & count, conf_pixel_t threshold,
+                       int height, int width)
+{
+  int n = 0;
+  FLOW_SPARSE_OUTER: for(int r=0; r<height; r++)
+  {
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    FLOW_SPARSE_INNER: for(int c=0; c<width; c++)
+    {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
+      #pragma HLS pipeline II=3
+      flow_record_t rec;
+      conf_pixel_t conf;
+      rec.index = r * width + c;
+      rec.flow.x(31, 0) = Input_1.read();
+      rec.flow.y(31, 0) = Input_1.read();
+      conf(31, 0) = Input_1.read();
+      if (conf > threshold)
       {
-        buf[0] = buf[1] = 0;
+        records[n] = rec;
+        n++;
       }
+    }
+  }
+  count = n;
+}
+
+// flow_calc output averaged over block x block tiles (8 or 16) with one
+// block row of partial sums; blocks at the right and bottom that are not
+// whole are dropped
+void flow_write_blocks(hls::stream< bit32> & Input_1,
+                       block_flow_t blocks[MAX_HEIGHT/MIN_BLOCK][MAX_WIDTH/MIN_BLOCK],
+                       int block, int height, int width)
+{
+  // up to 256 vectors and confidences per sum
+  ap_fixed<40,21> sum_x[MAX_WIDTH/MIN_BLOCK];
+  ap_fixed<40,21> sum_y[MAX_WIDTH/MIN_BLOCK];
+  ap_ufixed<40,-4> sum_conf[MAX_WIDTH/MIN_BLOCK];
+  ap_uint<9> count[MAX_WIDTH/MIN_BLOCK];
+
+  int shift = (block == 16) ? 4 : 3;
+  int mask = (1 << shift) - 1;
+  int block_rows = height >> shift;
+  int block_cols = width >> shift;
 
-      outputs[r][c].x = (vel_pixel_t)buf[0];
-      outputs[r][c].y = (vel_pixel_t)buf[1];
+  FLOW_BLOCKS_OUTER: for(int r=0; r<height; r++)
+  {
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    FLOW_BLOCKS_INNER: for(int c=0; c<width; c++)
+    {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
+      #pragma HLS pipeline II=3
+      vel_pixel_t vx, vy;
+      conf_pixel_t conf;
+      vx(31, 0) = Input_1.read();
+      vy(31, 0) = Input_1.read();
+      conf(31, 0) = Input_1.read();
+
+      int bc = c >> shift;
+      if ((r >> shift) >= block_rows || bc >= block_cols)
+        continue;
 
+      bool first = (r & mask) == 0 && (c & mask) == 0;
+      bool last = (r & mask) == mask && (c & mask) == mask;
+      bool valid = conf > 0;
+
+      ap_fixed<40,21> sx = first ? (ap_fixed<40,21>) 0 : sum_x[bc];
+      ap_fixed<40,21> sy = first ? (ap_fixed<40,21>) 0 : sum_y[bc];
+      ap_ufixed<40,-4> sc = first ? (ap_ufixed<40,-4>) 0 : sum_conf[bc];
+      ap_uint<9> n = first ? (ap_uint<9>) 0 : count[bc];
+      if (valid)
+      {
+        sx += vx;
+        sy += vy;
+        n++;
+      }
+      sc += conf;
+      sum_x[bc] = sx;
+      sum_y[bc] = sy;
+      sum_conf[bc] = sc;
+      count[bc] = n;
+
+      if (last)
+      {
+        block_flow_t out;
+        if (n != 0)
+        {
+          out.flow.x = sx / n;
+          out.flow.y = sy / n;
+        }
+        else
+        {
+          out.flow.x = 0;
+          out.flow.y = 0;
+        }
+        out.conf = (conf_pixel_t)(sc >> (2*shift));
+        blocks[r >> shift][bc] = out;
+      }
     }
   }
 }
 
-// top-level kernel function
-void optical_flow(hls::stream<frames_t> & Input_1,
-                  velocity_t outputs[MAX_HEIGHT][MAX_WIDTH])
+// what unpack leaves of height x width frames: the decimation it applies
+// (anything but 2 or 4 means none) and the raster the rest of the chain
+// runs on; the top-level functions work this out in front of their
+// dataflow regions, which hold only declarations and process calls
+static void decimated_size(int height, int width, int & decimate,
+                           int & out_height, int & out_width)
 {
-  #pragma HLS data_pack variable=outputs
+  decimate = (decimate == 2 || decimate == 4) ? decimate : 1;
+  out_height = height / decimate;
+  out_width = width / decimate;
+}
 
+// the operator chain from the packed frames to the flow_calc stream:
+// unpack takes height x width frames and the rest runs on the
+// out_height x out_width raster, where the operators without line
+// buffers see rows = out_height * channels rows of one frame; with
+// several channels, row r of every channel follows row r of the
+// previous one (in and out), each with its own line buffer columns
+static void optical_flow_chain(hls::stream<frames_t> & Input_1,
+                               hls::stream< bit32 > & Output_1,
+                               hls::stream< bit32 > & frame3_a,
+                               hls::stream< bit32 > & frame1_a,
+                               hls::stream< bit32 > & frame2_a,
+                               hls::stream< bit32 > & frame4_a,
+                               hls::stream< bit32 > & frame5_a,
+                               hls::stream< bit32 > & frame3_b,
+                               hls::stream< bit32 > & gradient_x,
+                               hls::stream< bit32 > & gradient_y,
+                               hls::stream< bit32 > & gradient_z,
+                               hls::stream< bit32 > & y_filtered,
+                               hls::stream< bit32 > & filtered_gradient,
+                               hls::stream< bit32 > & out_product,
+                               hls::stream< bit32 > & tensor_y,
+                               hls::stream< bit32 > & tensor,
+                               int height, int width, int decimate,
+                               int out_height, int out_width, int rows,
+                               int nframes, int channels)
+{
+  #pragma HLS DATAFLOW
+
+  unpack(Input_1, frame1_a, frame2_a, frame4_a, frame5_a, frame3_a, frame3_b, height, width, decimate, nframes, channels);
+
+  //
+  // compute
+  gradient_xy_calc(frame3_a, gradient_x, gradient_y, out_height, out_width, channels);
+  gradient_z_calc(frame1_a, frame2_a, frame3_b, frame4_a, frame5_a, gradient_z, rows, out_width, nframes);
+  gradient_weight_y(gradient_x, gradient_y, gradient_z, y_filtered, out_height, out_width, channels);
+  gradient_weight_x(y_filtered, filtered_gradient, rows, out_width);
+  outer_product(filtered_gradient, out_product, rows, out_width);
+  tensor_weight_y(out_product, tensor_y, out_height, out_width, channels);
+  tensor_weight_x(tensor_y, tensor, rows, out_width);
+  flow_calc(tensor, Output_1, out_height, out_width, decimate, channels);
+
+}
+
+// the chain on streams of its own
+void optical_flow_stream(hls::stream<frames_t> & Input_1,
+                         hls::stream< bit32 > & Output_1,
+                         int height, int width, int decimate,
+                         int out_height, int out_width, int rows,
+                         int nframes, int channels)
+{
   #pragma HLS DATAFLOW
 
   //Need to duplicate frame3 for the two calculations
@@ -131,16 +415,197 @@ void optical_flow(hls::stream<frames_t> & Input_1,
   hls::stream< bit32 > tensor_y;
   hls::stream< bit32 > tensor;
 
-  unpack(Input_1, frame1_a, frame2_a, frame4_a, frame5_a, frame3_a, frame3_b);
-  //
-  // compute
-  gradient_xy_calc(frame3_a, gradient_x, gradient_y);
-  gradient_z_calc(frame1_a, frame2_a, frame3_b, frame4_a, frame5_a, gradient_z);
-  gradient_weight_y(gradient_x, gradient_y, gradient_z, y_filtered);
-  gradient_weight_x(y_filtered, filtered_gradient);
-  outer_product(filtered_gradient, out_product);
-  tensor_weight_y(out_product, tensor_y);
-  tensor_weight_x(tensor_y, tensor);
-  flow_calc(tensor, outputs);
+  optical_flow_chain(Input_1, Output_1, frame3_a, frame1_a, frame2_a, frame4_a, frame5_a, frame3_b,
+                     gradient_x, gradient_y, gradient_z, y_filtered, filtered_gradient,
+                     out_product, tensor_y, tensor, height, width, decimate,
+                     out_height, out_width, rows, nframes, channels);
+}
+
+// the chain on the caller's streams (host only, see flow_streams_t)
+void optical_flow_stream(hls::stream<frames_t> & Input_1,
+                         hls::stream< bit32 > & Output_1,
+                         flow_streams_t & s,
+                         int height, int width, int decimate,
+                         int out_height, int out_width, int rows,
+                         int nframes, int channels)
+{
+  optical_flow_chain(Input_1, Output_1, s.frame3_a, s.frame1_a, s.frame2_a, s.frame4_a, s.frame5_a, s.frame3_b,
+                     s.gradient_x, s.gradient_y, s.gradient_z, s.y_filtered, s.filtered_gradient,
+                     s.out_product, s.tensor_y, s.tensor, height, width, decimate,
+                     out_height, out_width, rows, nframes, channels);
+}
+
+static void optical_flow_dataflow(hls::stream<frames_t> & Input_1,
+                                  velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                                  int height, int width, int decimate,
+                                  int out_height, int out_width, int rows,
+                                  int flow_width, int nframes, int channels)
+{
+  #pragma HLS DATAFLOW
+
+  // the channel rows of the stream are the rows of the side-by-side flows
+  hls::stream< bit32 > flow;
+  optical_flow_stream(Input_1, flow, height, width, decimate, out_height, out_width, rows, nframes, channels);
+  flow_write(flow, outputs, out_height, flow_width);
+}
+
+// top-level kernel function
+// frames of height x width (at most MAX_HEIGHT x MAX_WIDTH) are streamed
+// in; the flow fills the top-left height x width corner of outputs, or
+// (height/decimate) x (width/decimate) of it when unpack decimates;
+// nframes selects the temporal gradient (see TEMPORAL_*_FRAME)
+void optical_flow(hls::stream<frames_t> & Input_1,
+                  velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                  int height, int width, int decimate, int nframes, int channels)
+{
+  #pragma HLS data_pack variable=outputs
+
+  int out_height, out_width;
+  decimated_size(height, width, decimate, out_height, out_width);
+  int rows = out_height * channels;
+  int flow_width = out_width * channels;
+  optical_flow_dataflow(Input_1, outputs, height, width, decimate,
+                        out_height, out_width, rows, flow_width, nframes, channels);
+}
+
+// optical_flow on the caller's streams (host only)
+void optical_flow(hls::stream<frames_t> & Input_1,
+                  velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                  flow_streams_t & streams,
+                  int height, int width, int decimate, int nframes, int channels)
+{
+  int out_height, out_width;
+  decimated_size(height, width, decimate, out_height, out_width);
+  int rows = out_height * channels;
+  int flow_width = out_width * channels;
+  optical_flow_stream(Input_1, streams.flow, streams, height, width, decimate,
+                      out_height, out_width, rows, nframes, channels);
+  flow_write(streams.flow, outputs, out_height, flow_width);
+}
+
+static void optical_flow_confidence_dataflow(hls::stream<frames_t> & Input_1,
+                                             velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                                             conf_pixel_t confidence[MAX_HEIGHT][MAX_WIDTH],
+                                             int height, int width, int decimate,
+                                             int out_height, int out_width, int nframes)
+{
+  #pragma HLS DATAFLOW
+
+  hls::stream< bit32 > flow;
+  optical_flow_stream(Input_1, flow, height, width, decimate, out_height, out_width, out_height, nframes, 1);
+  flow_write_confidence(flow, outputs, confidence, out_height, out_width);
+}
+
+// top-level kernel function with the confidence of every vector
+void optical_flow_confidence(hls::stream<frames_t> & Input_1,
+                             velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                             conf_pixel_t confidence[MAX_HEIGHT][MAX_WIDTH],
+                             int height, int width, int decimate, int nframes)
+{
+  #pragma HLS data_pack variable=outputs
+
+  int out_height, out_width;
+  decimated_size(height, width, decimate, out_height, out_width);
+  optical_flow_confidence_dataflow(Input_1, outputs, confidence, height, width, decimate,
+                                   out_height, out_width, nframes);
+}
+
+static void optical_flow_blocks_dataflow(hls::stream<frames_t> & Input_1,
+                                         block_flow_t blocks[MAX_HEIGHT/MIN_BLOCK][MAX_WIDTH/MIN_BLOCK],
+                                         int block, int height, int width, int decimate,
+                                         int out_height, int out_width, int nframes)
+{
+  #pragma HLS DATAFLOW
+
+  hls::stream< bit32 > flow;
+  optical_flow_stream(Input_1, flow, height, width, decimate, out_height, out_width, out_height, nframes, 1);
+  flow_write_blocks(flow, blocks, block, out_height, out_width);
+}
+
+// top-level kernel function for one vector per block x block tile
+void optical_flow_blocks(hls::stream<frames_t> & Input_1,
+                         block_flow_t blocks[MAX_HEIGHT/MIN_BLOCK][MAX_WIDTH/MIN_BLOCK],
+                         int block, int height, int width, int decimate, int nframes)
+{
+  #pragma HLS data_pack variable=blocks
+
+  int out_height, out_width;
+  decimated_size(height, width, decimate, out_height, out_width);
+  optical_flow_blocks_dataflow(Input_1, blocks, block, height, width, decimate,
+                               out_height, out_width, nframes);
+}
+
+static void optical_flow_planar_dataflow(hls::stream<frames_t> & Input_1,
+                                         vel_pixel_t outputs_x[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                                         vel_pixel_t outputs_y[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                                         int pitch, int height, int width, int decimate,
+                                         int out_height, int out_width, int nframes)
+{
+  #pragma HLS DATAFLOW
+
+  hls::stream< bit32 > flow;
+  optical_flow_stream(Input_1, flow, height, width, decimate, out_height, out_width, out_height, nframes, 1);
+  flow_write_planar(flow, outputs_x, outputs_y, pitch, out_height, out_width);
+}
+
+// top-level kernel function for the planar x and y output
+void optical_flow_planar(hls::stream<frames_t> & Input_1,
+                         vel_pixel_t outputs_x[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                         vel_pixel_t outputs_y[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                         int pitch, int height, int width, int decimate, int nframes)
+{
+  int out_height, out_width;
+  decimated_size(height, width, decimate, out_height, out_width);
+  optical_flow_planar_dataflow(Input_1, outputs_x, outputs_y, pitch, height, width, decimate,
+                               out_height, out_width, nframes);
+}
+
+static void optical_flow_packed_dataflow(hls::stream<frames_t> & Input_1,
+                                         bit32 outputs[MAX_HEIGHT][MAX_WIDTH],
+                                         int frac_bits, int height, int width, int decimate,
+                                         int out_height, int out_width, int nframes)
+{
+  #pragma HLS DATAFLOW
+
+  hls::stream< bit32 > flow;
+  optical_flow_stream(Input_1, flow, height, width, decimate, out_height, out_width, out_height, nframes, 1);
+  flow_write_packed(flow, outputs, frac_bits, out_height, out_width);
+}
+
+// top-level kernel function for the 16-bit packed vectors
+void optical_flow_packed(hls::stream<frames_t> & Input_1,
+                         bit32 outputs[MAX_HEIGHT][MAX_WIDTH],
+                         int frac_bits, int height, int width, int decimate, int nframes)
+{
+  int out_height, out_width;
+  decimated_size(height, width, decimate, out_height, out_width);
+  optical_flow_packed_dataflow(Input_1, outputs, frac_bits, height, width, decimate,
+                               out_height, out_width, nframes);
+}
+
+static void optical_flow_sparse_dataflow(hls::stream<frames_t> & Input_1,
+                                         flow_record_t records[MAX_HEIGHT * MAX_WIDTH],
+                                         int & count, conf_pixel_t threshold,
+                                         int height, int width, int decimate,
+                                         int out_height, int out_width, int nframes)
+{
+  #pragma HLS DATAFLOW
+
+  hls::stream< bit32 > flow;
+  optical_flow_stream(Input_1, flow, height, width, decimate, out_height, out_width, out_height, nframes, 1);
+  flow_write_sparse(flow, records, count, threshold, out_height, out_width);
+}
+
+// top-level kernel function for the confident pixels only
+void optical_flow_sparse(hls::stream<frames_t> & Input_1,
+                         flow_record_t records[MAX_HEIGHT * MAX_WIDTH],
+                         int & count, conf_pixel_t threshold,
+                         int height, int width, int decimate, int nframes)
+{
+  #pragma HLS data_pack variable=records
 
+  int out_height, out_width;
+  decimated_size(height, width, decimate, out_height, out_width);
+  optical_flow_sparse_dataflow(Input_1, records, count, threshold, height, width, decimate,
+                               out_height, out_width, nframes);
 }
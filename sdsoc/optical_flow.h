@@ -16,8 +16,92 @@ const int GRAD_WEIGHTS[] =  {1,-8,0,8,-1};
 const pixel_t GRAD_FILTER[] = {0.0755, 0.133, 0.1869, 0.2903, 0.1869, 0.133, 0.0755};
 const pixel_t TENSOR_FILTER[] = {0.3243, 0.3513, 0.3243};
 
+// the last operator of the chain: three words per pixel, the two
+// velocity components and the confidence (for drivers that run the
+// operators one by one, like the process pipeline on the host)
+void flow_calc(hls::stream< bit32> & Input_1,
+               hls::stream< bit32> & Output_1,
+               int height, int width, int decimate, int channels = 1);
+
 // top-level function 
+// (height and width may be smaller than MAX_HEIGHT x MAX_WIDTH;
+//  decimate = 2 or 4 box-averages the frames first and returns the
+//  smaller flow field, in full-resolution pixels; nframes = 3 or 2
+//  streams fewer frames per pixel, see TEMPORAL_*_FRAME and unpack;
+//  channels > 1 runs that many independent height x width cameras
+//  through the one chain, rows interleaved as pack_frames lays them out,
+//  and puts their flows side by side: channel ch at column ch * width
+//  (channels * width must not exceed MAX_WIDTH))
 void optical_flow(hls::stream<frames_t> & Input_1,
-                  velocity_t outputs[MAX_HEIGHT][MAX_WIDTH]);
+                  velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                  int height = MAX_HEIGHT, int width = MAX_WIDTH,
+                  int decimate = 1, int nframes = TEMPORAL_5_FRAME,
+                  int channels = 1);
+
+// the streams between the operators of optical_flow(), for host code
+// that runs it on frame set after frame set: in C simulation an
+// hls::stream is a container, and keeping them saves building fourteen
+// of them on every call (not for synthesis, where the streams are FIFOs
+// local to the dataflow region)
+struct flow_streams_t
+{
+  hls::stream< bit32 > frame3_a, frame1_a, frame2_a, frame4_a, frame5_a, frame3_b;
+  hls::stream< bit32 > gradient_x, gradient_y, gradient_z;
+  hls::stream< bit32 > y_filtered, filtered_gradient;
+  hls::stream< bit32 > out_product, tensor_y, tensor;
+  hls::stream< bit32 > flow;
+};
+
+// optical_flow() on the streams of streams, which are empty again when
+// it returns
+void optical_flow(hls::stream<frames_t> & Input_1,
+                  velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                  flow_streams_t & streams,
+                  int height = MAX_HEIGHT, int width = MAX_WIDTH,
+                  int decimate = 1, int nframes = TEMPORAL_5_FRAME,
+                  int channels = 1);
+
+// top-level function that also returns the confidence of every vector,
+// the determinant of its structure tensor (0 where the flow is not
+// computed or the solve is singular)
+void optical_flow_confidence(hls::stream<frames_t> & Input_1,
+                             velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                             conf_pixel_t confidence[MAX_HEIGHT][MAX_WIDTH],
+                             int height = MAX_HEIGHT, int width = MAX_WIDTH,
+                             int decimate = 1, int nframes = TEMPORAL_5_FRAME);
+
+// top-level function that returns every vector packed in one word, x in
+// bits 15..0 and y in bits 31..16, as signed 16-bit values with frac_bits
+// fraction bits (rounded, and saturated at +-2^(15-frac_bits) pixels)
+void optical_flow_packed(hls::stream<frames_t> & Input_1,
+                         bit32 outputs[MAX_HEIGHT][MAX_WIDTH],
+                         int frac_bits = PACKED_FRAC_BITS,
+                         int height = MAX_HEIGHT, int width = MAX_WIDTH,
+                         int decimate = 1, int nframes = TEMPORAL_5_FRAME);
+
+// top-level function that returns the x and y components in separate
+// planes, row r of the flow at r * pitch (width <= pitch <= MAX_PLANAR_PITCH)
+void optical_flow_planar(hls::stream<frames_t> & Input_1,
+                         vel_pixel_t outputs_x[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                         vel_pixel_t outputs_y[MAX_HEIGHT * MAX_PLANAR_PITCH],
+                         int pitch = MAX_WIDTH,
+                         int height = MAX_HEIGHT, int width = MAX_WIDTH,
+                         int decimate = 1, int nframes = TEMPORAL_5_FRAME);
+
+// top-level function that returns one vector per block x block tile of
+// the flow (block = 8 or 16): the mean of its vectors with a nonzero
+// confidence and its mean confidence; tiles that are not whole are dropped
+void optical_flow_blocks(hls::stream<frames_t> & Input_1,
+                         block_flow_t blocks[MAX_HEIGHT/MIN_BLOCK][MAX_WIDTH/MIN_BLOCK],
+                         int block, int height = MAX_HEIGHT, int width = MAX_WIDTH,
+                         int decimate = 1, int nframes = TEMPORAL_5_FRAME);
+
+// top-level function that returns only the pixels whose confidence
+// exceeds threshold, as count (index, velocity) records in raster order
+void optical_flow_sparse(hls::stream<frames_t> & Input_1,
+                         flow_record_t records[MAX_HEIGHT * MAX_WIDTH],
+                         int & count, conf_pixel_t threshold,
+                         int height = MAX_HEIGHT, int width = MAX_WIDTH,
+                         int decimate = 1, int nframes = TEMPORAL_5_FRAME);
 
 #endif
@@ -4,15 +4,18 @@
 
 // outer product
 void outer_product(hls::stream< bit32> & Input_1,
-		hls::stream< bit32> & Output_1)
+		hls::stream< bit32> & Output_1,
+		int height, int width)
 {
 
   bit32 out_tmp;
 
-  OUTER_OUTER: for(int r=0; r<MAX_HEIGHT; r++)
+  OUTER_OUTER: for(int r=0; r<height; r++)
   {
-    OUTER_INNER: for(int c=0; c<MAX_WIDTH; c++)
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    OUTER_INNER: for(int c=0; c<width; c++)
     {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
       #pragma HLS pipeline II=1
       gradient_t grad;
       grad.x(31, 0) = Input_1.read();
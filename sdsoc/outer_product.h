@@ -1,2 +1,3 @@
 void outer_product(hls::stream< bit32> & Input_1,
-		hls::stream< bit32> & Output_1);
+		hls::stream< bit32> & Output_1,
+		int height, int width);
@@ -3,20 +3,23 @@
 
 
 void tensor_weight_x(hls::stream< bit32> & Input_1,
-		hls::stream< bit32> & Output_1)
+		hls::stream< bit32> & Output_1,
+		int height, int width)
 {
   bit32 in_tmp, out_tmp;
   hls::Window<1,3,tensor_t> buf;
   const pixel_t TENSOR_FILTER[] = {0.3243, 0.3513, 0.3243};
   //const float TENSOR_FILTER[] = {0.3243, 0.3513, 0.3243};
-  TENSOR_WEIGHT_X_OUTER: for(int r=0; r<MAX_HEIGHT; r++)
+  TENSOR_WEIGHT_X_OUTER: for(int r=0; r<height; r++)
   {
-    TENSOR_WEIGHT_X_INNER: for(int c=0; c<MAX_WIDTH+1; c++)
+    #pragma HLS loop_tripcount max=MAX_HEIGHT
+    TENSOR_WEIGHT_X_INNER: for(int c=0; c<width+1; c++)
     {
+      #pragma HLS loop_tripcount max=MAX_WIDTH
       #pragma HLS pipeline II=1
       buf.shift_pixels_left();
       tensor_t tmp;
-      if(c<MAX_WIDTH)
+      if(c<width)
       {
         //tmp = tensor_y[r][c];
           in_tmp = Input_1.read();
@@ -54,7 +57,7 @@ void tensor_weight_x(hls::stream< bit32> & Input_1,
       tensor_t acc;
       TENSOR_WEIGHT_X_ACC_INIT: for(int k =0; k<6; k++)
         acc.val[k] = 0;
-      if (c >= 2 && c < MAX_WIDTH)
+      if (c >= 2 && c < width)
       {
         TENSOR_WEIGHT_X_TMP_OUTER: for(int i=0; i<3; i++)
         {
@@ -1,2 +1,3 @@
 void tensor_weight_y(hls::stream< bit32> & Input_1,
-		hls::stream< bit32> & Output_1);
+		hls::stream< bit32> & Output_1,
+		int height, int width, int channels);
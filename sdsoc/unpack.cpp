@@ -7,56 +7,112 @@ void unpack(
 		hls::stream< bit32 > & Output_3,
 		hls::stream< bit32 > & Output_4,
 		hls::stream< bit32 > & Output_5,
-		hls::stream< bit32 > & Output_6
+		hls::stream< bit32 > & Output_6,
+		int height, int width, int decimate, int nframes, int channels
 									 )
 {
 
-	static frames_t buf;
+	frames_t buf;
+	// partial sums of the decimation blocks along one output line
+	// (16 pixels of 8 bits at most)
+	ap_uint<12> acc[5][MAX_WIDTH];
+	#pragma HLS ARRAY_PARTITION variable=acc complete dim=1
+	ap_uint<8> in[5], pix[5];
+	#pragma HLS ARRAY_PARTITION variable=in complete dim=1
+	#pragma HLS ARRAY_PARTITION variable=pix complete dim=1
 	input_t frame1_a, frame2_a, frame3_a, frame4_a, frame5_a, frame3_b;
 	bit32 out_tmp;
 	out_tmp = 0;
-	FRAMES_CP_OUTER: for (int r=0; r<MAX_HEIGHT; r++)
+
+	// 2x2 and 4x4 box averages, anything else passes the frames through
+	int shift = (decimate == 4) ? 2 : ((decimate == 2) ? 1 : 0);
+	int mask = (1 << shift) - 1;
+	int out_height = height >> shift;
+	int out_width = width >> shift;
+
+	// frames_t words hold 1, 2 or 4 pixels of nframes frames each (oldest
+	// first).  The frames fill the five slots of the 5-frame layout so that
+	// slot 2 is always the frame the flow is computed at: 3 frames go to
+	// slots 1-3 and 2 frames to slots 1-2; unused slots stream zeros.
+	int ppw_mask = pixels_per_word(nframes) - 1;
+	int slot_bits = 8 * nframes;
+	int first_slot = (nframes == TEMPORAL_5_FRAME) ? 0 : 1;
+
+	FRAMES_CP_OUTER: for (int r=0; r<height; r++)
 	  {
-		FRAMES_CP_INNER: for (int c=0; c<MAX_WIDTH; c++)
+	    #pragma HLS loop_tripcount max=MAX_HEIGHT
+		FRAMES_CP_CHANNEL: for(int ch=0; ch<channels; ch++)
 		{
-		  #pragma HLS pipeline II=1
+		  #pragma HLS loop_tripcount max=MAX_CHANNELS
+		  int base = ch * out_width;    // this channel's partial sums
+		  FRAMES_CP_INNER: for (int c=0; c<width; c++)
+		  {
+		    #pragma HLS loop_tripcount max=MAX_WIDTH
+		    #pragma HLS pipeline II=1
+
+		    // one wide read per word
+		    if ((c & ppw_mask) == 0)
+		      buf = Input_1.read();
+		    frames_t word = buf >> ((c & ppw_mask) * slot_bits);
+		    FRAMES_CP_SLOTS: for (int i=0; i<5; i++)
+		    {
+		      int j = i - first_slot;
+		      in[i] = (j >= 0 && j < nframes) ? (ap_uint<8>) word(8*j+7, 8*j) : (ap_uint<8>) 0;
+		    }
+		    // printf("0x%08x\n",(unsigned int) buf(63, 32));
+		    // printf("0x%08x\n",(unsigned int) buf(31,  0));
+
+		    // the rows and columns past the last whole block are dropped
+		    int oc = c >> shift;
+		    if ((r >> shift) >= out_height || oc >= out_width)
+		      continue;
+
+		    bool first = (r & mask) == 0 && (c & mask) == 0;
+		    bool last = (r & mask) == mask && (c & mask) == mask;
+		    FRAMES_CP_ACC: for (int i=0; i<5; i++)
+		    {
+		      ap_uint<12> sum = first ? (ap_uint<12>) 0 : acc[i][base + oc];
+		      sum += in[i];
+		      acc[i][base + oc] = sum;
+		      // rounded block average
+		      pix[i] = (sum + ((1 << (2*shift)) >> 1)) >> (2*shift);
+		    }
+		    if (!last)
+		      continue;
 
-		  // one wide read
-		  buf = Input_1.read();
-		  // printf("0x%08x\n",(unsigned int) buf(63, 32));
-		  // printf("0x%08x\n",(unsigned int) buf(31,  0));
-		  // assign values to the FIFOs
+		    // assign values to the FIFOs
 
 
-		  frame1_a = ((input_t)(buf(7 ,  0)) >> 8);
-		  out_tmp(16, 0) = frame1_a(16, 0);
-		  Output_1.write(out_tmp);
+		    frame1_a = ((input_t)(pix[0]) >> 8);
+		    out_tmp(16, 0) = frame1_a(16, 0);
+		    Output_1.write(out_tmp);
 
 
-		  frame2_a = ((input_t)(buf(15,  8)) >> 8);
-		  out_tmp(16, 0) = frame2_a(16, 0);
-		  Output_2.write(out_tmp);
+		    frame2_a = ((input_t)(pix[1]) >> 8);
+		    out_tmp(16, 0) = frame2_a(16, 0);
+		    Output_2.write(out_tmp);
 
 
-		  frame3_a = ((input_t)(buf(23, 16)) >> 8);
-		  out_tmp(16, 0) = frame3_a(16, 0);
-		  Output_5.write(out_tmp);
+		    frame3_a = ((input_t)(pix[2]) >> 8);
+		    out_tmp(16, 0) = frame3_a(16, 0);
+		    Output_5.write(out_tmp);
 
 
-		  frame3_b = ((input_t)(buf(23, 16)) >> 8);
-		  out_tmp(16, 0) = frame3_b(16, 0);
-		  Output_6.write(out_tmp);
+		    frame3_b = ((input_t)(pix[2]) >> 8);
+		    out_tmp(16, 0) = frame3_b(16, 0);
+		    Output_6.write(out_tmp);
 
 
-		  frame4_a = ((input_t)(buf(31, 24)) >> 8);
-		  out_tmp(16, 0) = frame4_a(16, 0);
-		  Output_3.write(out_tmp);
+		    frame4_a = ((input_t)(pix[3]) >> 8);
+		    out_tmp(16, 0) = frame4_a(16, 0);
+		    Output_3.write(out_tmp);
 
 
-		  frame5_a = ((input_t)(buf(39, 32)) >> 8);
-		  out_tmp(16, 0) = frame5_a(16, 0);
-		  Output_4.write(out_tmp);
+		    frame5_a = ((input_t)(pix[4]) >> 8);
+		    out_tmp(16, 0) = frame5_a(16, 0);
+		    Output_4.write(out_tmp);
 
+		  }
 		}
 	  }
 
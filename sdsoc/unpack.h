@@ -6,4 +6,5 @@ void unpack(
 		hls::stream< bit32 > & Output_3,
 		hls::stream< bit32 > & Output_4,
 		hls::stream< bit32 > & Output_5,
-		hls::stream< bit32 > & Output_6);
+		hls::stream< bit32 > & Output_6,
+		int height, int width, int decimate, int nframes, int channels);
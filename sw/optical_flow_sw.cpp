@@ -0,0 +1,384 @@
+/*===============================================================*/
+/*                                                               */
+/*                     optical_flow_sw.cpp                       */
+/*                                                               */
+/*             Software version of the optical flow              */
+/*                                                               */
+/*===============================================================*/
+
+#include <vector>
+
+#include "optical_flow_sw.h"
+#include "../sdsoc/optical_flow.h"
+
+// gradients around a region that reach its flow: 3 for the gradient
+// weighting plus 1 for the tensor weighting, in both directions
+const int SW_HALO = 4;
+
+// temporal taps over the five unpack slots, as in gradient_z_calc
+const int SW_GRAD_Z_WEIGHTS[3][5] = {{1,-8,0,8,-1}, {0,-1,0,1,0}, {0,-1,1,0,0}};
+const int SW_GRAD_Z_DIVISOR[3] = {12, 2, 1};
+
+// the frames as unpack hands them to the operators
+typedef struct{
+  const uchar *slot[5];   // 0 for slots the temporal mode leaves empty
+  int stride[5];          // bytes between the rows of each slot
+  int mode;               // row of SW_GRAD_Z_WEIGHTS
+  int height;
+  int width;
+}sw_frames_t;
+
+static sw_frames_t make_frames(const uchar *const planes[], const int strides[],
+                               int width, int height, int nframes)
+{
+  if (nframes != TEMPORAL_5_FRAME && nframes != TEMPORAL_3_FRAME && nframes != TEMPORAL_2_FRAME)
+    throw CError("optical_flow_sw: %d frames per pixel is not supported", nframes);
+
+  // same slot layout as unpack: slot 2 is the frame the flow is at
+  sw_frames_t f;
+  int first_slot = (nframes == TEMPORAL_5_FRAME) ? 0 : 1;
+  for (int i = 0; i < 5; i++)
+  {
+    int j = i - first_slot;
+    bool used = j >= 0 && j < nframes;
+    f.slot[i] = used ? planes[j] : 0;
+    f.stride[i] = used ? strides[j] : 0;
+  }
+  f.mode = (nframes == TEMPORAL_3_FRAME) ? 1 : ((nframes == TEMPORAL_2_FRAME) ? 2 : 0);
+  f.height = height;
+  f.width = width;
+  return f;
+}
+
+static sw_frames_t make_frames(CByteImage imgs[], int nframes)
+{
+  if (nframes != TEMPORAL_5_FRAME && nframes != TEMPORAL_3_FRAME && nframes != TEMPORAL_2_FRAME)
+    throw CError("optical_flow_sw: %d frames per pixel is not supported", nframes);
+
+  CShape sh = imgs[0].Shape();
+  if (sh.nBands != 1)
+    throw CError("optical_flow_sw: frames must be gray");
+  for (int i = 1; i < nframes; i++)
+    if (imgs[i].Shape() != sh)
+      throw CError("optical_flow_sw: frame %d differs in size from frame 0", i);
+
+  const uchar *planes[5];
+  int strides[5];
+  for (int i = 0; i < nframes; i++)
+  {
+    planes[i] = &imgs[i].Pixel(0, 0, 0);
+    strides[i] = imgs[i].RowSize();
+  }
+  return make_frames(planes, strides, sh.width, sh.height, nframes);
+}
+
+static input_t frame_value(sw_frames_t& f, int slot, int r, int c)
+{
+  if (f.slot[slot] == 0)
+    return 0;
+  ap_uint<8> pix = f.slot[slot][(size_t) r * f.stride[slot] + c];
+  return ((input_t)(pix) >> 8);
+}
+
+// gradient_xy_calc and gradient_z_calc at one pixel
+static gradient_t gradient_at(sw_frames_t& f, int r, int c)
+{
+  gradient_t g;
+  g.x = g.y = g.z = 0;
+  if (r < 0 || r >= f.height || c < 0 || c >= f.width)
+    return g;
+
+  if (r >= 2 && r < f.height-2 && c >= 2 && c < f.width-2)
+  {
+    pixel_t x_grad = 0;
+    pixel_t y_grad = 0;
+    for (int i = 0; i < 5; i++)
+    {
+      x_grad += frame_value(f, 2, r, c-2+i)*GRAD_WEIGHTS[i];
+      y_grad += frame_value(f, 2, r-2+i, c)*GRAD_WEIGHTS[i];
+    }
+    g.x = x_grad/12;
+    g.y = y_grad/12;
+  }
+
+  const int *w = SW_GRAD_Z_WEIGHTS[f.mode];
+  g.z = ((pixel_t)(frame_value(f, 0, r, c)*w[0]
+                 + frame_value(f, 1, r, c)*w[1]
+                 + frame_value(f, 2, r, c)*w[2]
+                 + frame_value(f, 3, r, c)*w[3]
+                 + frame_value(f, 4, r, c)*w[4]))/SW_GRAD_Z_DIVISOR[f.mode];
+  return g;
+}
+
+// flow_calc at one pixel
+static velocity_t solve(tensor_t& t)
+{
+  calc_pixel_t t1 = (calc_pixel_t) t.val[0];
+  calc_pixel_t t2 = (calc_pixel_t) t.val[1];
+  calc_pixel_t t4 = (calc_pixel_t) t.val[3];
+  calc_pixel_t t5 = (calc_pixel_t) t.val[4];
+  calc_pixel_t t6 = (calc_pixel_t) t.val[5];
+
+  calc_pixel_t denom = t1*t2-t4*t4;
+  calc_pixel_t numer0 = t6*t4-t5*t2;
+  calc_pixel_t numer1 = t5*t4-t6*t1;
+
+  outer_pixel_t buf[2];
+  if (denom != 0)
+  {
+    buf[0] = numer0 / denom;
+    buf[1] = numer1 / denom;
+  }
+  else
+  {
+    buf[0] = 0;
+    buf[1] = 0;
+  }
+
+  velocity_t v;
+  v.x = (vel_pixel_t)buf[0];
+  v.y = (vel_pixel_t)buf[1];
+  return v;
+}
+
+static void flow_region(sw_frames_t& f, int x0, int y0, int w, int h,
+                        velocity_t *out, int out_stride)
+{
+  // every stage lives on the same grid, the region plus the halo; each
+  // is evaluated on the part of it the next stage reads
+  int gh = h + 2*SW_HALO;
+  int gw = w + 2*SW_HALO;
+  int gy0 = y0 - SW_HALO;
+  int gx0 = x0 - SW_HALO;
+  std::vector<gradient_t> grad(gh * gw), grad_y(gh * gw);
+  std::vector<outer_t> outer(gh * gw);
+  std::vector<tensor_t> tensor_y(gh * gw);
+
+  for (int i = 0; i < gh; i++)
+    for (int j = 0; j < gw; j++)
+      grad[i*gw + j] = gradient_at(f, gy0 + i, gx0 + j);
+
+  // gradient_weight_y: rows 3 .. height-4
+  for (int i = 3; i < gh-3; i++)
+  {
+    int r = gy0 + i;
+    for (int j = 0; j < gw; j++)
+    {
+      gradient_t acc;
+      acc.x = acc.y = acc.z = 0;
+      if (r >= 3 && r < f.height-3)
+        for (int k = 0; k < 7; k++)
+        {
+          gradient_t& g = grad[(i-3+k)*gw + j];
+          acc.x += g.x*GRAD_FILTER[k];
+          acc.y += g.y*GRAD_FILTER[k];
+          acc.z += g.z*GRAD_FILTER[k];
+        }
+      grad_y[i*gw + j] = acc;
+    }
+  }
+
+  // gradient_weight_x: columns 3 .. width-4, then outer_product
+  for (int i = 3; i < gh-3; i++)
+    for (int j = 3; j < gw-3; j++)
+    {
+      int c = gx0 + j;
+      gradient_t acc;
+      acc.x = acc.y = acc.z = 0;
+      if (c >= 3 && c < f.width-3)
+        for (int k = 0; k < 7; k++)
+        {
+          gradient_t& g = grad_y[i*gw + j-3+k];
+          acc.x += g.x*GRAD_FILTER[k];
+          acc.y += g.y*GRAD_FILTER[k];
+          acc.z += g.z*GRAD_FILTER[k];
+        }
+
+      outer_pixel_t x = (outer_pixel_t) acc.x;
+      outer_pixel_t y = (outer_pixel_t) acc.y;
+      outer_pixel_t z = (outer_pixel_t) acc.z;
+      outer_t& o = outer[i*gw + j];
+      o.val[0] = (x*x);
+      o.val[1] = (y*y);
+      o.val[2] = (z*z);
+      o.val[3] = (x*y);
+      o.val[4] = (x*z);
+      o.val[5] = (y*z);
+    }
+
+  // tensor_weight_y: rows 1 .. height-2
+  for (int i = SW_HALO; i < gh-SW_HALO; i++)
+  {
+    int r = gy0 + i;
+    for (int j = 3; j < gw-3; j++)
+    {
+      tensor_t acc;
+      for (int k = 0; k < 6; k++)
+        acc.val[k] = 0;
+      if (r >= 1 && r < f.height-1)
+        for (int n = 0; n < 3; n++)
+        {
+          outer_t& o = outer[(i-1+n)*gw + j];
+          pixel_t k = TENSOR_FILTER[n];
+          for (int component = 0; component < 6; component++)
+            acc.val[component] += o.val[component]*k;
+        }
+      tensor_y[i*gw + j] = acc;
+    }
+  }
+
+  // tensor_weight_x: columns 1 .. width-2, then flow_calc
+  for (int i = SW_HALO; i < gh-SW_HALO; i++)
+  {
+    int r = gy0 + i;
+    velocity_t *row = out + (i-SW_HALO) * out_stride;
+    for (int j = SW_HALO; j < gw-SW_HALO; j++)
+    {
+      int c = gx0 + j;
+      tensor_t acc;
+      for (int k = 0; k < 6; k++)
+        acc.val[k] = 0;
+      if (c >= 1 && c < f.width-1)
+        for (int n = 0; n < 3; n++)
+        {
+          tensor_t& t = tensor_y[i*gw + j-1+n];
+          for (int component = 0; component < 6; component++)
+            acc.val[component] += t.val[component]*TENSOR_FILTER[n];
+        }
+
+      velocity_t v;
+      v.x = v.y = 0;
+      if (r >= 2 && r < f.height-2 && c >= 2 && c < f.width-2)
+        v = solve(acc);
+      row[j-SW_HALO] = v;
+    }
+  }
+}
+
+void optical_flow_sw_region(CByteImage imgs[], int nframes,
+                            int x0, int y0, int w, int h,
+                            velocity_t *out, int out_stride)
+{
+  sw_frames_t f = make_frames(imgs, nframes);
+  if (w > 0 && h > 0)
+    flow_region(f, x0, y0, w, h, out, out_stride);
+}
+
+void optical_flow_sw(CByteImage imgs[],
+                     velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                     int nframes)
+{
+  sw_frames_t f = make_frames(imgs, nframes);
+  if (f.height > MAX_HEIGHT || f.width > MAX_WIDTH)
+    throw CError("optical_flow_sw: frames must be at most MAX_WIDTH x MAX_HEIGHT");
+  flow_region(f, 0, 0, f.width, f.height, &outputs[0][0], MAX_WIDTH);
+}
+
+void optical_flow_sw(const uchar *const planes[], const int strides[],
+                     int width, int height,
+                     velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                     int nframes)
+{
+  sw_frames_t f = make_frames(planes, strides, width, height, nframes);
+  if (height < 1 || height > MAX_HEIGHT || width < 1 || width > MAX_WIDTH)
+    throw CError("optical_flow_sw: frames must be at most MAX_WIDTH x MAX_HEIGHT");
+  flow_region(f, 0, 0, width, height, &outputs[0][0], MAX_WIDTH);
+}
+
+int optical_flow_sw_activity(CByteImage imgs[], int nframes,
+                             float threshold, CByteImage& tiles)
+{
+  sw_frames_t f = make_frames(imgs, nframes);
+  int th = (f.height + SW_TILE_SIZE - 1) / SW_TILE_SIZE;
+  int tw = (f.width + SW_TILE_SIZE - 1) / SW_TILE_SIZE;
+
+  // the weighted sum of gray levels is SW_GRAD_Z_DIVISOR times |gz|
+  const int *w = SW_GRAD_Z_WEIGHTS[f.mode];
+  float limit = threshold * SW_GRAD_Z_DIVISOR[f.mode];
+  CByteImage moving(CShape(tw, th, 1));
+  moving.ClearPixels();
+  const uchar *rows[5];
+  for (int r = 0; r < f.height; r++)
+  {
+    for (int i = 0; i < 5; i++)
+      rows[i] = f.slot[i] ? f.slot[i] + (size_t) r * f.stride[i] : 0;
+    uchar *flags = moving.Row(r / SW_TILE_SIZE).Data();
+    for (int c = 0; c < f.width; c++)
+    {
+      int sum = 0;
+      for (int i = 0; i < 5; i++)
+        if (rows[i])
+          sum += w[i] * rows[i][c];
+      if (sum > limit || -sum > limit)
+        flags[c / SW_TILE_SIZE] = 1;
+    }
+  }
+
+  // dilate by one tile (the 4-pixel halo never reaches further)
+  tiles.ReAllocate(CShape(tw, th, 1));
+  int active = 0;
+  for (int ty = 0; ty < th; ty++)
+    for (int tx = 0; tx < tw; tx++)
+    {
+      uchar on = 0;
+      for (int dy = -1; dy <= 1; dy++)
+        for (int dx = -1; dx <= 1; dx++)
+        {
+          int y = ty + dy, x = tx + dx;
+          if (y >= 0 && y < th && x >= 0 && x < tw && moving.Pixel(x, y, 0))
+            on = 1;
+        }
+      tiles.Pixel(tx, ty, 0) = on;
+      active += on;
+    }
+  return active;
+}
+
+int optical_flow_sw_active(CByteImage imgs[],
+                           velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                           float threshold, int nframes)
+{
+  sw_frames_t f = make_frames(imgs, nframes);
+  if (f.height > MAX_HEIGHT || f.width > MAX_WIDTH)
+    throw CError("optical_flow_sw: frames must be at most MAX_WIDTH x MAX_HEIGHT");
+  CByteImage tiles;
+  int active = optical_flow_sw_activity(imgs, nframes, threshold, tiles);
+  CShape tsh = tiles.Shape();
+
+  for (int ty = 0; ty < tsh.height; ty++)
+  {
+    int y0 = ty * SW_TILE_SIZE;
+    int h = __min(SW_TILE_SIZE, f.height - y0);
+    const uchar *flags = tiles.Row(ty).Data();
+    for (int tx = 0; tx < tsh.width; )
+    {
+      // runs of active tiles share one region, and so their halos
+      int end = tx + 1;
+      while (end < tsh.width && flags[end] == flags[tx])
+        end++;
+      int x0 = tx * SW_TILE_SIZE;
+      int w = __min(end * SW_TILE_SIZE, f.width) - x0;
+      if (flags[tx])
+        flow_region(f, x0, y0, w, h, &outputs[y0][x0], MAX_WIDTH);
+      else
+        for (int r = y0; r < y0 + h; r++)
+          for (int c = x0; c < x0 + w; c++)
+            outputs[r][c].x = outputs[r][c].y = 0;
+      tx = end;
+    }
+  }
+  return active;
+}
+
+void optical_flow_sw_sparse(CByteImage imgs[],
+                            const feature_t points[], int npoints,
+                            velocity_t flow[],
+                            int nframes)
+{
+  sw_frames_t f = make_frames(imgs, nframes);
+  for (int i = 0; i < npoints; i++)
+  {
+    // a 1 x 1 region: 9 x 9 gradients and a single solve
+    flow_region(f, points[i].x, points[i].y, 1, 1, &flow[i], 1);
+  }
+}
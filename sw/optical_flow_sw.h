@@ -0,0 +1,66 @@
+/*===============================================================*/
+/*                                                               */
+/*                      optical_flow_sw.h                        */
+/*                                                               */
+/*             Software version of the optical flow              */
+/*                                                               */
+/*===============================================================*/
+
+#ifndef __OPTICAL_FLOW_SW_H__
+#define __OPTICAL_FLOW_SW_H__
+
+#include "../host/typedefs.h"
+#include "../host/imageLib.h"
+
+// The operator chain of optical_flow() evaluated per pixel instead of as
+// a stream, with the same fixed-point types, filters and border rules,
+// so the results are bit-exact with the hardware.  Because every stage
+// is random access, flow can be computed for a part of the frame only.
+//
+// imgs holds nframes gray frames, oldest first (as for pack_frames).
+
+// flow over the h x w rectangle at (x0, y0), written row by row to out
+// (out_stride vectors apart); the stages run on the rectangle plus the
+// 4-pixel halo of gradients its tensors reach
+void optical_flow_sw_region(CByteImage imgs[], int nframes,
+                            int x0, int y0, int w, int h,
+                            velocity_t *out, int out_stride);
+
+// dense flow over the whole frame, same as optical_flow()
+void optical_flow_sw(CByteImage imgs[],
+                     velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                     int nframes = TEMPORAL_5_FRAME);
+
+// the same straight from caller-owned width x height gray planes, plane i
+// at planes[i] with rows strides[i] bytes apart (see pack_frames)
+void optical_flow_sw(const uchar *const planes[], const int strides[],
+                     int width, int height,
+                     velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                     int nframes = TEMPORAL_5_FRAME);
+
+// side of the tiles of the activity map
+const int SW_TILE_SIZE = 16;
+
+// activity map of the frames, one pixel per SW_TILE_SIZE tile: 1 where
+// some temporal gradient |gz| of the tile exceeds threshold (in gray
+// levels per frame), dilated by one tile so that the tiles whose flow
+// window reaches a moving tile are included; returns the active count
+int optical_flow_sw_activity(CByteImage imgs[], int nframes,
+                             float threshold, CByteImage& tiles);
+
+// dense flow over the active tiles only, zero flow elsewhere; with a
+// threshold of 0 this is exactly optical_flow_sw(), as a tile without
+// any temporal gradient in reach has zero flow anyway
+int optical_flow_sw_active(CByteImage imgs[],
+                           velocity_t outputs[MAX_HEIGHT][MAX_WIDTH],
+                           float threshold = 0,
+                           int nframes = TEMPORAL_5_FRAME);
+
+// flow at npoints feature points only; flow[i] is what the dense field
+// holds at points[i] (zero outside the frame and its 2-pixel border)
+void optical_flow_sw_sparse(CByteImage imgs[],
+                            const feature_t points[], int npoints,
+                            velocity_t flow[],
+                            int nframes = TEMPORAL_5_FRAME);
+
+#endif